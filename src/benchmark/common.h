@@ -1,3 +1,16 @@
 #pragma once
 
-#define MRAM_BUFFER_SIZE ((6396) << 10)
\ No newline at end of file
+// Size of the "test_buffer" MRAM region
+#define MRAM_BUFFER_SIZE ((6396) << 10)
+
+// 1 KB stream blocks keep the per-tasklet buffers within WRAM next to
+// wram_buffer and the tasklet stacks
+#define MRAM_STREAM_BLOCK_SIZE 1024
+#include "mram_stream_layout.h"
+
+// DPU_PROFILE sections of the benchmark program
+#define SECTION_STREAM_READ 0
+#define SECTION_STREAM_MAP 1
+
+// DPU cycles per second, to turn DPU-side cycle counts into bandwidth
+#define DPU_FREQUENCY (350 * 1000 * 1000)
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <defs.h>
 #include <mram.h>
-#include <perfcounter.h>
 #include "common.h"
+#include "dpu_profile.h"
+#include "mram_regions.h"
+#include "mram_stream.h"
 
 __host int64_t DPU_ID;
 
@@ -12,10 +14,13 @@ const int WRAM_BUFFER_SIZE_IN_INT64 = WRAM_BUFFER_SIZE / sizeof(uint64_t);
 __host uint64_t wram_buffer[WRAM_BUFFER_SIZE_IN_INT64];
 
 __host int64_t MRAM_TEST;
-const int MRAM_BUFFER_SIZE_IN_INT64 = MRAM_BUFFER_SIZE / sizeof(uint64_t);
 __host uint64_t wram_buffer_for_mram[128]; // 1 KB
 __mram uint8_t placeholder[1 << 20];
 
+__host int64_t STREAM_TEST;
+__host mram_stream_result_t STREAM_READ_RESULT;
+__host mram_stream_result_t STREAM_MAP_RESULT;
+
 void StandardOutput() {
     printf("HEAP POINTER ADDR: %p\n", DPU_MRAM_HEAP_POINTER);
     printf("DPU ID is %lld!\n", DPU_ID);
@@ -32,8 +37,10 @@ void wram_test() {
 
 void mram_test() {
     uint64_t offset = (DPU_ID << 48);
-    __mram_ptr uint64_t* mram_buffer = (__mram_ptr uint64_t*) DPU_MRAM_HEAP_POINTER;
-    for (int i = 0; i < MRAM_BUFFER_SIZE_IN_INT64; i += 256) {
+    mram_region_t *region = mram_region_find("test_buffer");
+    __mram_ptr uint64_t* mram_buffer = (__mram_ptr uint64_t*) mram_region_address(region);
+    const int mram_buffer_size_in_int64 = region->size / sizeof(uint64_t);
+    for (int i = 0; i < mram_buffer_size_in_int64; i += 256) {
         mram_buffer[i] += offset + (uint64_t)i;
     }
     // printf("id=%lld\n", DPU_ID);
@@ -41,12 +48,63 @@ void mram_test() {
     //     for (int i = 0; i < 2; i ++) {
     //         printf("%x %llx\n", mram_buffer + i, mram_buffer[i]);
     //     }
-    //     printf("MRAM: min=%16llx max=%16llx\n", mram_buffer[0], mram_buffer[MRAM_BUFFER_SIZE_IN_INT64 - 1]);
+    //     printf("MRAM: min=%16llx max=%16llx\n", mram_buffer[0], mram_buffer[mram_buffer_size_in_int64 - 1]);
     // } // will get random results because the memory isn't initialized
 }
 // __mram uint64_t val[1 << 20];
 
+void checksum_block(uint8_t *wram, uint32_t size, uint32_t offset, void *arg) {
+    (void)offset;
+    uint64_t *checksum = (uint64_t *)arg;
+    uint64_t *words = (uint64_t *)wram;
+    for (uint32_t i = 0; i < size / sizeof(uint64_t); i ++) {
+        *checksum ^= words[i];
+    }
+}
+
+void keep_block(uint8_t *wram, uint32_t size, uint32_t offset, void *arg) {
+    (void)wram, (void)size, (void)offset, (void)arg;
+}
+
+// DPU-side MRAM bandwidth over the whole test buffer, all tasklets: a read
+// pass and an in-place read/write pass that leaves the data unchanged.
+void stream_test() {
+    mram_region_t *region = mram_region_find("test_buffer");
+    __mram_ptr uint8_t *mram_buffer = mram_region_address(region);
+    uint32_t size = region->size;
+    uint64_t checksum = 0;
+
+    mram_stream_sync();
+    perfcounter_t start = perfcounter_get();
+    DPU_PROFILE_BEGIN(SECTION_STREAM_READ);
+    mram_stream_read(mram_buffer, size, checksum_block, &checksum);
+    DPU_PROFILE_END(SECTION_STREAM_READ);
+    checksum = mram_stream_reduce_xor(checksum);
+    if (me() == 0) {
+        STREAM_READ_RESULT.cycles = perfcounter_get() - start;
+        STREAM_READ_RESULT.bytes = size;
+        STREAM_READ_RESULT.checksum = checksum;
+    }
+    mram_stream_sync();
+    start = perfcounter_get();
+    DPU_PROFILE_BEGIN(SECTION_STREAM_MAP);
+    mram_stream_map(mram_buffer, size, keep_block, NULL);
+    DPU_PROFILE_END(SECTION_STREAM_MAP);
+    mram_stream_sync();
+    if (me() == 0) {
+        STREAM_MAP_RESULT.cycles = perfcounter_get() - start;
+        STREAM_MAP_RESULT.bytes = 2 * size;
+        STREAM_MAP_RESULT.checksum = checksum;
+    }
+}
+
 int main() {
+    DPU_PROFILE_INIT();
+    if (STREAM_TEST) {
+        stream_test();
+        DPU_PROFILE_FINISH();
+        return 0;
+    }
     if (me() == 0) {
         StandardOutput();
         mram_test();
@@ -59,5 +117,6 @@ int main() {
     //     wram_test();
     // }
 
+    DPU_PROFILE_FINISH();
     return 0;
 }
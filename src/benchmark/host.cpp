@@ -8,24 +8,30 @@
 #include <sys/mman.h>
 
 #include "common.h"
+#include "mram_allocator.hpp"
 #include "pim_interface_header.hpp"
+#include "pim_profile.hpp"
 #include "timer.hpp"
+#include "transfer_tuner.hpp"
 using namespace std;
 
 enum CommunicationDirection { Host2PIM = 0, PIM2Host = 1 };
 
 void parse_arguments(int argc, char **argv, int &nr_ranks,
-                     string &interfaceType) {
-    if (argc < 3) {
+                     string &interfaceType, string &profilePath) {
+    if (argc < 3 || (argc > 3 && string(argv[3]) != "calibrate")) {
         fprintf(
             stderr,
-            "Usage: %s <nr_ranks> <Interface Type>\n",
+            "Usage: %s <nr_ranks> <Interface Type> [calibrate [profile path]]\n",
             argv[0]);
         exit(1);
     }
 
     sscanf(argv[1], "%d", &nr_ranks);
     interfaceType = argv[2];
+    if (argc > 3) {
+        profilePath = argc > 4 ? argv[4] : PIMTransferParameters::LocalProfilePath();
+    }
 
     if (interfaceType != "direct" && interfaceType != "UPMEM") {
         fprintf(stderr,
@@ -33,10 +39,15 @@ void parse_arguments(int argc, char **argv, int &nr_ranks,
                 "'UPMEM'.\n");
         exit(1);
     }
+    if (!profilePath.empty() && interfaceType != "direct") {
+        fprintf(stderr, "Only the direct interface can be calibrated.\n");
+        exit(1);
+    }
 }
 
 void TestMRAMThroughput(PIMInterface *interface,
-                        size_t MaxBufferSizePerDPU) {
+                        const PIMMRAMRegion &region) {
+    const size_t MaxBufferSizePerDPU = region.size;
     const size_t MinTestSizePerDPU = 1 << 10;
     const size_t MaxTestSizePerDPU = std::min((size_t)1 << 20, MaxBufferSizePerDPU);
     const double timeLimitPerTest = 2.0;  // 2 seconds
@@ -89,8 +100,8 @@ void TestMRAMThroughput(PIMInterface *interface,
 
             send_timer.start();
             // CPU -> PIM.MRAM : Supported by both direct and UPMEM interface.
-            interface->SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                 bufferSizePerDPU, false);
+            interface->SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME,
+                                 region.offset, bufferSizePerDPU, false);
             
             send_timer.end();
 
@@ -104,8 +115,8 @@ void TestMRAMThroughput(PIMInterface *interface,
             
             recv_timer.start();
             // PIM.MRAM -> CPU : Supported by both direct and UPMEM interface.
-            interface->ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                      bufferSizePerDPU, false);
+            interface->ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME,
+                                      region.offset, bufferSizePerDPU, false);
             recv_timer.end();
 
             // for (size_t i = 0; i < nrOfDPUs; i ++) {
@@ -159,11 +170,138 @@ void TestMRAMThroughput(PIMInterface *interface,
     free(buffer);
 }
 
+// Send bandwidth when the values TestMRAMThroughput stages in per-DPU
+// buffers are instead generated line by line inside the transfer, with
+// only the first 4 KB per DPU read back to check them.
+void TestGeneratedSend(DirectPIMInterface *interface,
+                       const PIMMRAMRegion &region) {
+    const size_t MinTestSizePerDPU = 1 << 10;
+    const size_t MaxTestSizePerDPU = std::min((size_t)1 << 20, (size_t)region.size);
+    const size_t CheckSizePerDPU = 4 << 10;
+    const double timeLimitPerTest = 1.0;
+    const size_t repeatLimitPerTest = 500;
+
+    int nrOfDPUs = interface->GetNrOfDPUs();
+    uint64_t *check = new uint64_t[nrOfDPUs * CheckSizePerDPU / 8];
+    uint8_t **checkBuffer = new uint8_t *[nrOfDPUs];
+    for (int i = 0; i < nrOfDPUs; i++) {
+        checkBuffer[i] = (uint8_t *)(check + i * CheckSizePerDPU / 8);
+    }
+
+    size_t round = 0;  // of the send in progress
+    auto get_value = [&](size_t i, size_t j) -> uint64_t {
+        return parlay::hash64((i << 50) | (j << 20) | round);
+    };
+    auto generator = [&](uint32_t dpu, uint32_t word_begin,
+                         uint32_t nr_of_words, uint64_t *words) {
+        for (uint32_t k = 0; k < nr_of_words; k++) {
+            words[k] = get_value(dpu, word_begin + k);
+        }
+    };
+
+    for (size_t bufferSizePerDPU = MinTestSizePerDPU;
+         bufferSizePerDPU <= MaxTestSizePerDPU; bufferSizePerDPU <<= 1) {
+        internal_timer send_timer;
+        size_t repeat = 0;
+        for (; repeat < repeatLimitPerTest &&
+               send_timer.total_time < timeLimitPerTest;
+             repeat++) {
+            round = repeat;
+            send_timer.start();
+            interface->SendGeneratedToPIM(generator, DPU_MRAM_HEAP_POINTER_NAME,
+                                          region.offset, bufferSizePerDPU);
+            send_timer.end();
+        }
+
+        size_t checkSize = std::min(bufferSizePerDPU, CheckSizePerDPU);
+        interface->ReceiveFromPIM(checkBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME,
+                                  region.offset, checkSize, false);
+        parlay::parallel_for(0, nrOfDPUs, [&](size_t i) {
+            for (size_t j = 0; j < checkSize / 8; j++) {
+                assert(((uint64_t *)checkBuffer[i])[j] == get_value(i, j));
+            }
+        });
+
+        double send_bandwidth = (double)bufferSizePerDPU * repeat * nrOfDPUs /
+                                send_timer.total_time;
+        printf("Generated send: Test Buffer Size: %5lu KB, Repeat: %6lu, "
+               "Send Time: %8.3lf s, Send BW: %8.3lf GB/s, Send Lat: %5g s\n",
+               bufferSizePerDPU / 1024, repeat, send_timer.total_time,
+               send_bandwidth / 1024.0 / 1024.0 / 1024.0,
+               send_timer.total_time / repeat);
+    }
+
+    delete[] checkBuffer;
+    delete[] check;
+}
+
+// DPU-side MRAM bandwidth, measured by the DPU program with all tasklets
+// on the whole test buffer, next to the host transfer numbers.
+void TestDPUStreamBandwidth(PIMInterface *interface) {
+    int nrOfDPUs = interface->GetNrOfDPUs();
+    uint8_t **flags = new uint8_t *[nrOfDPUs];
+    uint8_t **readResults = new uint8_t *[nrOfDPUs];
+    uint8_t **mapResults = new uint8_t *[nrOfDPUs];
+    for (int i = 0; i < nrOfDPUs; i++) {
+        flags[i] = new uint8_t[sizeof(int64_t)];
+        readResults[i] = new uint8_t[sizeof(mram_stream_result_t)];
+        mapResults[i] = new uint8_t[sizeof(mram_stream_result_t)];
+    }
+
+    auto SetStreamTest = [&](int64_t value) {
+        for (int i = 0; i < nrOfDPUs; i++) {
+            *(int64_t *)flags[i] = value;
+        }
+        interface->SendToPIMByUPMEM(flags, 0, "STREAM_TEST", 0, sizeof(int64_t), false);
+    };
+
+    SetStreamTest(1);
+    interface->Launch(false);
+    SetStreamTest(0);
+    interface->ReceiveFromPIM(readResults, 0, "STREAM_READ_RESULT", 0,
+                              sizeof(mram_stream_result_t), false);
+    interface->ReceiveFromPIM(mapResults, 0, "STREAM_MAP_RESULT", 0,
+                              sizeof(mram_stream_result_t), false);
+
+    auto Print = [&](const char *name, uint8_t **results) {
+        uint64_t maxCycles = 0, sumCycles = 0, bytes = 0;
+        for (int i = 0; i < nrOfDPUs; i++) {
+            mram_stream_result_t *result = (mram_stream_result_t *)results[i];
+            maxCycles = std::max(maxCycles, result->cycles);
+            sumCycles += result->cycles;
+            bytes = result->bytes;
+        }
+        double avgCycles = (double)sumCycles / nrOfDPUs;
+        double perDPU = (double)bytes * DPU_FREQUENCY / avgCycles;
+        double total = (double)bytes * nrOfDPUs * DPU_FREQUENCY / maxCycles;
+        printf("DPU %s: %5lu KB per DPU, Avg Cycles: %10.0lf, Max Cycles: %10lu, "
+               "BW per DPU: %8.3lf MB/s, Total BW: %8.3lf GB/s\n",
+               name, bytes / 1024, avgCycles, maxCycles,
+               perDPU / 1024.0 / 1024.0, total / 1024.0 / 1024.0 / 1024.0);
+    };
+    Print("MRAM Stream Read", readResults);
+    Print("MRAM Stream Read+Write", mapResults);
+
+    std::vector<std::string> sections(2);
+    sections[SECTION_STREAM_READ] = "stream read";
+    sections[SECTION_STREAM_MAP] = "stream read+write";
+    CollectPIMProfile(interface, NR_TASKLETS, sections).Print(stdout, DPU_FREQUENCY);
+
+    for (int i = 0; i < nrOfDPUs; i++) {
+        delete[] flags[i];
+        delete[] readResults[i];
+        delete[] mapResults[i];
+    }
+    delete[] flags;
+    delete[] readResults;
+    delete[] mapResults;
+}
+
 int main(int argc, char **argv) {
     int nr_ranks;
-    string interfaceType;
+    string interfaceType, profilePath;
 
-    parse_arguments(argc, argv, nr_ranks, interfaceType);
+    parse_arguments(argc, argv, nr_ranks, interfaceType, profilePath);
 
     // To Allocate: identify the number of RANKS you want, or use
     // DPU_ALLOCATE_ALL to allocate all possible.
@@ -175,6 +313,15 @@ int main(int argc, char **argv) {
     }
     // DirectPIMInterface pimInterface(DPU_ALLOCATE_ALL, "dpu");
 
+    // Sweep the direct transfer parameters and save them as this machine's
+    // profile, loaded by every later DirectPIMInterface.
+    if (!profilePath.empty()) {
+        PIMTransferTuner tuner((DirectPIMInterface *)pimInterface);
+        bool saved = tuner.Calibrate().Save(profilePath);
+        printf("Profile %s %s\n", saved ? "saved to" : "could not be saved to",
+               profilePath.c_str());
+    }
+
     int nrOfDPUs = pimInterface->GetNrOfDPUs();
     uint8_t **dpuIDs = new uint8_t *[nrOfDPUs];
     for (int i = 0; i < nrOfDPUs; i++) {
@@ -196,12 +343,40 @@ int main(int argc, char **argv) {
         assert(*id == (uint64_t)i);
     }
 
+    // MRAM layout: the test buffer is a named heap region, looked up by the
+    // DPU program through the published region table.
+    uint32_t heapSize = interfaceType == "direct"
+                            ? ((DirectPIMInterface *)pimInterface)->GetMRAMHeapSize()
+                            : MRAM_BUFFER_SIZE;
+    PIMMRAMAllocator allocator(pimInterface, heapSize);
+    const PIMMRAMRegion *testBufferRegion = allocator.Allocate("test_buffer", MRAM_BUFFER_SIZE);
+    assert(testBufferRegion != nullptr);
+    const PIMMRAMRegion testBuffer = *testBufferRegion;
+    allocator.Publish();
+
+    // PIM_TRACE=<path> records a timeline of the rest of the run.
+    const char *tracePath = getenv("PIM_TRACE");
+    if (tracePath != nullptr) {
+        PIMTrace::Start();
+    }
+
     // Execute : will call the UPMEM interface.
     pimInterface->Launch(false);
     pimInterface->PrintLog([](int i) { return (i % 100) == 0; });
 
-    TestMRAMThroughput(pimInterface, (6400 - 4) << 10);
-    TestMRAMThroughput(pimInterface, (6400 - 4) << 10);
+    TestMRAMThroughput(pimInterface, testBuffer);
+    TestMRAMThroughput(pimInterface, testBuffer);
+    if (interfaceType == "direct") {
+        TestGeneratedSend((DirectPIMInterface *)pimInterface, testBuffer);
+    }
+    TestDPUStreamBandwidth(pimInterface);
+
+    if (tracePath != nullptr) {
+        PIMTrace::Stop();
+        bool written = PIMTrace::WriteChromeTrace(tracePath);
+        printf("Trace %s %s\n", written ? "written to" : "could not be written to",
+               tracePath);
+    }
 
     for (int i = 0; i < nrOfDPUs; i++) {
         delete[] dpuIDs[i];
@@ -0,0 +1,48 @@
+#pragma once
+
+// Per-tasklet cycle counts of a DPU program, read back by the host. Every
+// tasklet calls DPU_PROFILE_INIT at the start of main and
+// DPU_PROFILE_FINISH at the end; sections are timed with
+//
+//     DPU_PROFILE_BEGIN(SECTION_SORT);
+//     ...
+//     DPU_PROFILE_END(SECTION_SORT);
+//
+// where the section is a constant below DPU_PROFILE_MAX_SECTIONS. The cycle
+// counter belongs to DPU_PROFILE_INIT: other code must not reconfigure it.
+
+#include <barrier.h>
+#include <defs.h>
+#include <perfcounter.h>
+
+#include "dpu_profile_layout.h"
+
+_Static_assert(NR_TASKLETS <= DPU_PROFILE_MAX_TASKLETS,
+               "too many tasklets for dpu_profile_t");
+
+__host dpu_profile_t DPU_PROFILE;
+BARRIER_INIT(dpu_profile_barrier, NR_TASKLETS);
+perfcounter_t dpu_profile_start[NR_TASKLETS];
+
+// Clears this tasklet's counters; tasklet 0 restarts the cycle counter.
+#define DPU_PROFILE_INIT()                                              \
+    do {                                                                \
+        for (int _s = 0; _s < DPU_PROFILE_MAX_SECTIONS; _s++) {         \
+            DPU_PROFILE.sections[_s][me()] = 0;                         \
+        }                                                               \
+        if (me() == 0) {                                                \
+            perfcounter_config(COUNT_CYCLES, true);                     \
+        }                                                               \
+        barrier_wait(&dpu_profile_barrier);                             \
+        dpu_profile_start[me()] = perfcounter_get();                    \
+    } while (0)
+
+#define DPU_PROFILE_FINISH()                                            \
+    (DPU_PROFILE.total[me()] = perfcounter_get() - dpu_profile_start[me()])
+
+#define DPU_PROFILE_BEGIN(section) \
+    perfcounter_t _dpu_profile_begin_##section = perfcounter_get()
+
+#define DPU_PROFILE_END(section)                    \
+    (DPU_PROFILE.sections[section][me()] +=         \
+     perfcounter_get() - _dpu_profile_begin_##section)
@@ -0,0 +1,18 @@
+#pragma once
+
+// Shared between host and DPU programs using dpu_profile.h. The host reads
+// the DPU_PROFILE WRAM symbol of every DPU (CollectPIMProfile).
+
+#include <stdint.h>
+
+#define DPU_PROFILE_SYMBOL "DPU_PROFILE"
+#define DPU_PROFILE_MAX_TASKLETS 16
+#define DPU_PROFILE_MAX_SECTIONS 8
+
+// Cycles per tasklet: from DPU_PROFILE_INIT to DPU_PROFILE_FINISH in total,
+// and summed over all DPU_PROFILE_BEGIN / DPU_PROFILE_END pairs of each
+// section. Sections are numbered by the program; the host names them.
+typedef struct {
+    uint64_t total[DPU_PROFILE_MAX_TASKLETS];
+    uint64_t sections[DPU_PROFILE_MAX_SECTIONS][DPU_PROFILE_MAX_TASKLETS];
+} dpu_profile_t;
@@ -0,0 +1,49 @@
+#pragma once
+
+// Shared between PIMKVStore (kv_lookup.hpp) and the DPU lookup kernel.
+//
+// Every DPU holds one open-addressing hash table with linear probing in the
+// KV_TABLE_REGION MRAM region: a kv_table_header_t, then `capacity`
+// kv_entry_t slots. A lookup round writes a kv_batch_header_t and the query
+// keys to KV_BATCH_REGION; the kernel replaces every key with its value.
+
+#include <stdint.h>
+
+#define KV_TABLE_REGION "kv_table"
+#define KV_BATCH_REGION "kv_batch"
+
+// Marks an empty slot; not a valid key.
+#define KV_EMPTY_KEY UINT64_MAX
+// The value returned for keys that are not in the table; not a valid value.
+#define KV_MISSING_VALUE UINT64_MAX
+
+// Slots fetched per MRAM read while probing.
+#define KV_PROBE_WINDOW 8
+
+typedef struct {
+    uint64_t key, value;
+} kv_entry_t;
+
+typedef struct {
+    uint32_t capacity;  // slots, a power of two
+    uint32_t nr_of_entries;
+} kv_table_header_t;
+
+typedef struct {
+    uint32_t nr_of_queries;
+    uint32_t padding;
+} kv_batch_header_t;
+
+// Thomas Wang's 64-bit mix: shifts, adds and xors only, as the DPU has no
+// 64-bit multiplier. The high half picks the DPU, the low bits the home
+// slot in its table.
+static inline uint64_t kv_hash(uint64_t key) {
+    key = (~key) + (key << 21);
+    key ^= key >> 24;
+    key = key + (key << 3) + (key << 8);
+    key ^= key >> 14;
+    key = key + (key << 2) + (key << 4);
+    key ^= key >> 28;
+    key += key << 31;
+    return key;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Shared between host and DPU programs using mram_regions.h. The host-side
+// PIMMRAMAllocator writes the table to MRAM_REGION_TABLE_SYMBOL in WRAM.
+
+#include <stdint.h>
+
+#define MRAM_REGION_TABLE_SYMBOL "MRAM_REGIONS"
+#define MRAM_REGION_NAME_LENGTH 24
+#define MRAM_REGION_MAX_COUNT 16
+
+// offset is in bytes from DPU_MRAM_HEAP_POINTER; name is NUL-terminated.
+typedef struct {
+    char name[MRAM_REGION_NAME_LENGTH];
+    uint32_t offset;
+    uint32_t size;
+} mram_region_t;
+
+typedef struct {
+    uint32_t nr_of_regions;
+    uint32_t heap_size;
+    mram_region_t regions[MRAM_REGION_MAX_COUNT];
+} mram_region_table_t;
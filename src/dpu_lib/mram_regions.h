@@ -0,0 +1,28 @@
+#pragma once
+
+// Named MRAM regions laid out by the host (see mram_region_table.h). The
+// table is valid once the host published it, before the launch.
+
+#include <defs.h>
+#include <mram.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "mram_region_table.h"
+
+__host mram_region_table_t MRAM_REGIONS;
+
+// Entry of the region called name, or NULL.
+static inline mram_region_t *mram_region_find(const char *name) {
+    for (uint32_t i = 0; i < MRAM_REGIONS.nr_of_regions; i++) {
+        if (strncmp(MRAM_REGIONS.regions[i].name, name,
+                    MRAM_REGION_NAME_LENGTH) == 0) {
+            return &MRAM_REGIONS.regions[i];
+        }
+    }
+    return NULL;
+}
+
+static inline __mram_ptr uint8_t *mram_region_address(const mram_region_t *region) {
+    return (__mram_ptr uint8_t *)DPU_MRAM_HEAP_POINTER + region->offset;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// Tasklet-parallel MRAM streaming for DPU programs. All tasklets call the
+// same function; each one moves whole MRAM_STREAM_BLOCK_SIZE blocks through
+// its own WRAM buffer, block-cyclically. DMA blocks the calling tasklet
+// only, so while one tasklet waits for its transfer the others compute on
+// theirs: the tasklets together form the multi-buffering pipeline.
+
+#include <barrier.h>
+#include <defs.h>
+#include <mram.h>
+#include <stdint.h>
+
+#include "mram_stream_layout.h"
+
+// f(wram, size, offset, arg): `size` bytes of the range starting at byte
+// `offset`, in the calling tasklet's buffer.
+typedef void (*mram_stream_fn)(uint8_t *wram, uint32_t size, uint32_t offset,
+                               void *arg);
+
+__dma_aligned uint8_t mram_stream_buffer[NR_TASKLETS][MRAM_STREAM_BLOCK_SIZE];
+BARRIER_INIT(mram_stream_barrier, NR_TASKLETS);
+uint64_t mram_stream_partial[NR_TASKLETS];
+
+static inline void mram_stream_sync() { barrier_wait(&mram_stream_barrier); }
+
+// Read [src, src + size) and pass every block to f.
+static inline void mram_stream_read(__mram_ptr uint8_t *src, uint32_t size,
+                                    mram_stream_fn f, void *arg) {
+    uint8_t *wram = mram_stream_buffer[me()];
+    for (uint32_t offset = MRAM_STREAM_BLOCK_OFFSET(me()); offset < size;
+         offset += MRAM_STREAM_BLOCK_OFFSET(NR_TASKLETS)) {
+        uint32_t block = size - offset < MRAM_STREAM_BLOCK_SIZE
+                             ? size - offset
+                             : MRAM_STREAM_BLOCK_SIZE;
+        mram_read(src + offset, wram, block);
+        f(wram, block, offset, arg);
+    }
+}
+
+// Fill [dst, dst + size) with the blocks f produces.
+static inline void mram_stream_write(__mram_ptr uint8_t *dst, uint32_t size,
+                                     mram_stream_fn f, void *arg) {
+    uint8_t *wram = mram_stream_buffer[me()];
+    for (uint32_t offset = MRAM_STREAM_BLOCK_OFFSET(me()); offset < size;
+         offset += MRAM_STREAM_BLOCK_OFFSET(NR_TASKLETS)) {
+        uint32_t block = size - offset < MRAM_STREAM_BLOCK_SIZE
+                             ? size - offset
+                             : MRAM_STREAM_BLOCK_SIZE;
+        f(wram, block, offset, arg);
+        mram_write(wram, dst + offset, block);
+    }
+}
+
+// Update [data, data + size) in place.
+static inline void mram_stream_map(__mram_ptr uint8_t *data, uint32_t size,
+                                   mram_stream_fn f, void *arg) {
+    uint8_t *wram = mram_stream_buffer[me()];
+    for (uint32_t offset = MRAM_STREAM_BLOCK_OFFSET(me()); offset < size;
+         offset += MRAM_STREAM_BLOCK_OFFSET(NR_TASKLETS)) {
+        uint32_t block = size - offset < MRAM_STREAM_BLOCK_SIZE
+                             ? size - offset
+                             : MRAM_STREAM_BLOCK_SIZE;
+        mram_read(data + offset, wram, block);
+        f(wram, block, offset, arg);
+        mram_write(wram, data + offset, block);
+    }
+}
+
+// Combine one value per tasklet; every tasklet gets the result.
+static inline uint64_t mram_stream_reduce_sum(uint64_t value) {
+    mram_stream_partial[me()] = value;
+    mram_stream_sync();
+    uint64_t result = 0;
+    for (int t = 0; t < NR_TASKLETS; t++) {
+        result += mram_stream_partial[t];
+    }
+    mram_stream_sync();  // partials may be reused after this
+    return result;
+}
+
+static inline uint64_t mram_stream_reduce_max(uint64_t value) {
+    mram_stream_partial[me()] = value;
+    mram_stream_sync();
+    uint64_t result = 0;
+    for (int t = 0; t < NR_TASKLETS; t++) {
+        if (mram_stream_partial[t] > result) {
+            result = mram_stream_partial[t];
+        }
+    }
+    mram_stream_sync();
+    return result;
+}
+
+static inline uint64_t mram_stream_reduce_xor(uint64_t value) {
+    mram_stream_partial[me()] = value;
+    mram_stream_sync();
+    uint64_t result = 0;
+    for (int t = 0; t < NR_TASKLETS; t++) {
+        result ^= mram_stream_partial[t];
+    }
+    mram_stream_sync();
+    return result;
+}
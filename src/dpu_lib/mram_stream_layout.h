@@ -0,0 +1,24 @@
+#pragma once
+
+// Shared between host and DPU programs using mram_stream.h.
+
+#include <stdint.h>
+
+// Bytes moved by one mram_read / mram_write; at most 2048, the DMA limit.
+#ifndef MRAM_STREAM_BLOCK_SIZE
+#define MRAM_STREAM_BLOCK_SIZE 2048
+#endif
+
+// Streamed MRAM ranges start and end on this boundary.
+#define MRAM_STREAM_ALIGN 8
+
+// Tasklet t handles blocks t, t + NR_TASKLETS, ... of a range, so block i
+// of a stream starts at i * MRAM_STREAM_BLOCK_SIZE.
+#define MRAM_STREAM_BLOCK_OFFSET(i) ((uint32_t)(i) * MRAM_STREAM_BLOCK_SIZE)
+
+// What a DPU reports about one timed stream, read back by the host.
+typedef struct {
+    uint64_t bytes;
+    uint64_t cycles;
+    uint64_t checksum;
+} mram_stream_result_t;
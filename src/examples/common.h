@@ -0,0 +1,5 @@
+#pragma once
+
+// WRAM words dirtied at run time by dpu_example (SCRATCH) and expected to
+// read as zero in dpu_example_zero (ZEROED) after a program switch
+#define SWITCH_TEST_WORDS 2048
@@ -3,8 +3,10 @@
 #include <mram.h>
 #include <perfcounter.h>
 #include <assert.h>
+#include "common.h"
 
 __host int64_t DPU_ID;
+__host uint64_t SCRATCH[SWITCH_TEST_WORDS];
 
 void StandardOutput() {
     printf("HEAP POINTER ADDR: %p\n", DPU_MRAM_HEAP_POINTER);
@@ -26,6 +28,9 @@ int main() {
     if (me() == 0) {
         StandardOutput();
         PrintMRAMHeap(4);
+        for (int i = 0; i < SWITCH_TEST_WORDS; i++) {
+            SCRATCH[i] = 0xa5a5a5a500000000ull | i;
+        }
     }
     return 0;
 }
@@ -0,0 +1,11 @@
+#include <defs.h>
+#include <stdint.h>
+#include "common.h"
+
+// Second program of the example's program-switch check: ZEROED must read
+// as zero after switching from dpu_example, whatever that one left in WRAM.
+__host uint64_t ZEROED[SWITCH_TEST_WORDS];
+
+int main() {
+    return 0;
+}
@@ -1,13 +1,40 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <thread>
 #include <parlay/parallel.h>
 
+#include "common.h"
+#include "mram_shadow.hpp"
+#include "mram_snapshot.hpp"
 #include "pim_interface_header.hpp"
+#include "program_cache.hpp"
+#include "shard_loader.hpp"
+#include "transfer_batch.hpp"
 using namespace std;
 
+// Block-wise MRAM address translation must agree with the reference layout,
+// including across 8 KB, 16 KB, 32 KB and 4 MB boundaries.
+void CheckMRAMAddressIterator() {
+    const uint64_t starts[] = {0, (8 << 10) - 64, (32 << 10) - 8,
+                               (4 << 20) - 256, MRAM_SIZE - (64 << 10)};
+    for (uint64_t start : starts) {
+        for (uint32_t dpu_id = 0; dpu_id < 4; dpu_id++) {
+            MRAMAddressIterator it(start, dpu_id);
+            for (uint64_t address = start; address < start + (64 << 10); address += 8, ++it) {
+                assert(*it == TranslateMRAMAddressOracle(address, dpu_id));
+                assert(*it + 0x40 == TranslateMRAMAddressOracle(address, dpu_id + 4));
+            }
+        }
+    }
+}
+
 int main() {
 
     const int NR_RANKS = 10;
 
+    CheckMRAMAddressIterator();
+
     // To Allocate: identify the number of RANKS you want, or use DPU_ALLOCATE_ALL to allocate all possible.
     DirectPIMInterface pimInterface(NR_RANKS, "dpu_example");
     // DirectPIMInterface pimInterface(DPU_ALLOCATE_ALL, "dpu");
@@ -32,6 +59,17 @@ int main() {
         assert(*id == (uint64_t)i);
     }
 
+    // PIM.WRAM -> CPU : several symbols in one batched pass.
+    for (int i = 0; i < nr_of_dpus; i++) {
+        memset(dpuIDs[i], 0, 16);
+    }
+    pimInterface.ReceiveFromPIMBatch({{dpuIDs, 0, "DPU_ID", 0, sizeof(uint32_t)},
+                                      {dpuIDs, 4, "DPU_ID", 4, sizeof(uint32_t)}});
+    for (int i = 0; i < nr_of_dpus; i++) {
+        uint64_t *id = (uint64_t *)dpuIDs[i];
+        assert(*id == (uint64_t)i);
+    }
+
     const int BUFFER_SIZE = 4 << 20;
     uint8_t **dpuBuffer = new uint8_t*[nr_of_dpus];
     for (int i = 0; i < nr_of_dpus; i++) {
@@ -55,10 +93,475 @@ int main() {
         });
     });
 
+    // PIM.MRAM -> CPU : element-wise reduction over all DPUs, no per-DPU buffers.
+    // Every DPU holds different words, so each one of every rank and dpu_id
+    // group must be folded in to get the sum, the max and the (32-bit) min.
+    {
+        const uint32_t REDUCE_SIZE = 256 << 10, REDUCE_WORDS = REDUCE_SIZE / sizeof(uint64_t);
+        auto word = [](uint64_t i, uint64_t k) {
+            return (i * 2654435761ull + k * 40503ull) % 1000003 + (i << 40);
+        };
+        parlay::parallel_for(0, nr_of_dpus, [&](size_t i) {
+            for (uint32_t k = 0; k < REDUCE_WORDS; k++) {
+                ((uint64_t *)dpuBuffer[i])[k] = word(i, k);
+            }
+        });
+        pimInterface.SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, REDUCE_SIZE, false);
+        vector<uint64_t> sum(REDUCE_WORDS), max(REDUCE_WORDS);
+        vector<uint32_t> min(2 * REDUCE_WORDS);
+        pimInterface.ReceiveFromPIMReduce(sum.data(), DPU_MRAM_HEAP_POINTER_NAME, 0, REDUCE_SIZE,
+                                          PIMReduceSum<uint64_t>());
+        pimInterface.ReceiveFromPIMReduce(max.data(), DPU_MRAM_HEAP_POINTER_NAME, 0, REDUCE_SIZE,
+                                          PIMReduceMax<uint64_t>());
+        pimInterface.ReceiveFromPIMReduce(min.data(), DPU_MRAM_HEAP_POINTER_NAME, 0, REDUCE_SIZE,
+                                          PIMReduceMin<uint32_t>());
+        parlay::parallel_for(0, REDUCE_WORDS, [&](size_t k) {
+            uint64_t expectedSum = 0, expectedMax = 0;
+            uint32_t expectedMin[2] = {UINT32_MAX, UINT32_MAX};
+            for (int i = 0; i < nr_of_dpus; i++) {
+                uint64_t w = word(i, k);
+                expectedSum += w;
+                expectedMax = std::max(expectedMax, w);
+                expectedMin[0] = std::min(expectedMin[0], (uint32_t)w);
+                expectedMin[1] = std::min(expectedMin[1], (uint32_t)(w >> 32));
+            }
+            assert(sum[k] == expectedSum);
+            assert(max[k] == expectedMax);
+            assert(min[2 * k] == expectedMin[0] && min[2 * k + 1] == expectedMin[1]);
+        });
+    }
+
+    // CPU -> PIM.MRAM : records bucketed by target DPU during the transfer.
+    struct Record {
+        uint64_t key, value;
+    };
+    const size_t NR_RECORDS = (size_t)nr_of_dpus * 64;
+    Record *records = new Record[NR_RECORDS];
+    for (size_t k = 0; k < NR_RECORDS; k++) {
+        records[k] = {k * k, k};
+    }
+    auto target = [&](const Record &r) { return (uint32_t)(r.key % nr_of_dpus); };
+    vector<uint64_t> counts = pimInterface.ScatterToPIM(
+        records, NR_RECORDS, target, DPU_MRAM_HEAP_POINTER_NAME, 0);
+    uint64_t maxCount = *max_element(counts.begin(), counts.end());
+    pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0,
+                                maxCount * sizeof(Record), false);
+    parlay::parallel_for(0, nr_of_dpus, [&](size_t i) {
+        Record *received = (Record *)dpuBuffer[i];
+        for (uint64_t k = 0; k < counts[i]; k++) {
+            assert(target(received[k]) == i);
+            assert(received[k].key == received[k].value * received[k].value);
+            assert(k == 0 || received[k - 1].value < received[k].value);
+        }
+    });
+    delete [] records;
+
+    // PIM.MRAM -> PIM.MRAM : every DPU sends one word to every DPU.
+    {
+        const uint32_t INBOX_OFFSET = 1 << 20;
+        uint32_t header = (nr_of_dpus + 1) / 2 * 2 * sizeof(uint32_t);
+        uint32_t outboxSize = header + nr_of_dpus * sizeof(uint64_t);
+        for (int s = 0; s < nr_of_dpus; s++) {
+            memset(dpuBuffer[s], 0, header);
+            for (int d = 0; d < nr_of_dpus; d++) {
+                ((uint32_t *)dpuBuffer[s])[d] = sizeof(uint64_t);
+                ((uint64_t *)(dpuBuffer[s] + header))[d] = (uint64_t)s * nr_of_dpus + d;
+            }
+        }
+        pimInterface.SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, outboxSize, false);
+        uint64_t inboxSize = pimInterface.AllToAll(DPU_MRAM_HEAP_POINTER_NAME, 0,
+                                                   DPU_MRAM_HEAP_POINTER_NAME, INBOX_OFFSET,
+                                                   BUFFER_SIZE - INBOX_OFFSET);
+        pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, INBOX_OFFSET,
+                                    inboxSize, false);
+        parlay::parallel_for(0, nr_of_dpus, [&](size_t d) {
+            PIMAllToAllEntry *entries = (PIMAllToAllEntry *)dpuBuffer[d];
+            for (int s = 0; s < nr_of_dpus; s++) {
+                assert(entries[s].length == sizeof(uint64_t));
+                uint64_t value = *(uint64_t *)(dpuBuffer[d] + entries[s].offset);
+                assert(value == (uint64_t)s * nr_of_dpus + d);
+            }
+        });
+
+        // An inbox one word too small is refused before anything is written.
+        const uint8_t UNTOUCHED = 0x5a;
+        for (int d = 0; d < nr_of_dpus; d++) {
+            memset(dpuBuffer[d], UNTOUCHED, inboxSize);
+        }
+        pimInterface.SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, INBOX_OFFSET,
+                               inboxSize, false);
+        uint64_t refused = pimInterface.AllToAll(DPU_MRAM_HEAP_POINTER_NAME, 0,
+                                                 DPU_MRAM_HEAP_POINTER_NAME, INBOX_OFFSET,
+                                                 inboxSize - sizeof(uint64_t));
+        assert(refused == UINT64_MAX);
+        (void)refused;
+        pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, INBOX_OFFSET,
+                                    inboxSize, false);
+        for (int d = 0; d < nr_of_dpus; d++) {
+            for (uint64_t j = 0; j < inboxSize; j++) {
+                assert(dpuBuffer[d][j] == UNTOUCHED);
+            }
+        }
+    }
+
+    // CPU -> PIM.MRAM : only the 8 KB blocks changed in a host shadow.
+    {
+        PIMShadowRegion shadow(&pimInterface, DPU_MRAM_HEAP_POINTER_NAME, 0, 1 << 20);
+        shadow.Load();
+        for (int i = 0; i < nr_of_dpus; i += 7) {
+            shadow.Write(i, (i * 4096) % (1 << 20), (uint64_t)i);
+        }
+        uint64_t sentBytes = shadow.Sync();
+        assert(sentBytes < (uint64_t)nr_of_dpus << 20);
+        (void)sentBytes;
+        pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, 1 << 20, false);
+        parlay::parallel_for(0, nr_of_dpus, [&](size_t i) {
+            assert(memcmp(dpuBuffer[i], shadow.Data(i), 1 << 20) == 0);
+        });
+    }
+
+    // CPU <-> PIM.MRAM : several transfers in one fused pass per rank.
+    {
+        PIMTransferBatch batch(&pimInterface);
+        batch.Send(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, 4096)
+            .Send(dpuBuffer, 4096, DPU_MRAM_HEAP_POINTER_NAME, 1 << 20, 4096)
+            .Receive(dpuBuffer, 8192, DPU_MRAM_HEAP_POINTER_NAME, 0, 4096)
+            .Receive(dpuBuffer, 12288, DPU_MRAM_HEAP_POINTER_NAME, 1 << 20, 4096);
+        batch.ExecuteAsync();
+        batch.Wait();
+        parlay::parallel_for(0, nr_of_dpus, [&](size_t i) {
+            assert(memcmp(dpuBuffer[i], dpuBuffer[i] + 8192, 8192) == 0);
+        });
+
+        // Synchronously, and with a receive ahead of a send to the same
+        // MRAM: it must see the bytes from before the send.
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < nr_of_dpus; i++) {
+                for (int j = 0; j < 4096; j++) {
+                    dpuBuffer[i][16384 + j] = (uint8_t)(i + j * 5 + round);
+                }
+            }
+            PIMTransferBatch ordered(&pimInterface);
+            ordered.Receive(dpuBuffer, 20480, DPU_MRAM_HEAP_POINTER_NAME, 0, 4096)
+                .Send(dpuBuffer, 16384, DPU_MRAM_HEAP_POINTER_NAME, 0, 4096)
+                .Receive(dpuBuffer, 24576, DPU_MRAM_HEAP_POINTER_NAME, 0, 4096);
+            if (round == 0) {
+                ordered.Execute();
+            } else {
+                ordered.ExecuteAsync();
+                ordered.Wait();
+            }
+            // Round 0 reads what the first batch sent, round 1 what round 0 did.
+            parlay::parallel_for(0, nr_of_dpus, [&](size_t i) {
+                if (round == 0) {
+                    assert(memcmp(dpuBuffer[i] + 20480, dpuBuffer[i], 4096) == 0);
+                } else {
+                    for (int j = 0; j < 4096; j++) {
+                        assert(dpuBuffer[i][20480 + j] == (uint8_t)(i + j * 5));
+                    }
+                }
+                assert(memcmp(dpuBuffer[i] + 24576, dpuBuffer[i] + 16384, 4096) == 0);
+            });
+        }
+    }
+
+    // CPU <-> PIM.MRAM : low-latency path for a few bytes per DPU.
+    uint32_t heapAddress = pimInterface.GetMRAMSymbolAddress(DPU_MRAM_HEAP_POINTER_NAME);
+    for (int i = 0; i < nr_of_dpus; i++) {
+        for (int k = 0; k < 32; k++) {
+            ((uint64_t *)dpuBuffer[i])[k] = (uint64_t)i * 32 + k;
+        }
+    }
+    pimInterface.SendToPIMSmall<256>(dpuBuffer, 0, heapAddress);
+    for (int i = 0; i < nr_of_dpus; i++) {
+        memset(dpuBuffer[i], 0, 256);
+    }
+    pimInterface.ReceiveFromPIMSmall(dpuBuffer, 0, heapAddress, 256);
+    for (int i = 0; i < nr_of_dpus; i++) {
+        for (int k = 0; k < 32; k++) {
+            assert(((uint64_t *)dpuBuffer[i])[k] == (uint64_t)i * 32 + k);
+        }
+    }
+
+    // PIM.MRAM -> CPU : a different byte count per DPU, read from MRAM
+    // first. Sizes include 0, sizes that are not a multiple of 8 and one
+    // above max_length, which is clamped.
+    {
+        const uint32_t MAX_LENGTH = 4096, SIZE_OFFSET = 1 << 20;
+        auto expectedSize = [&](int i) -> uint64_t {
+            return i % 5 == 0 ? 0 : i == 1 ? MAX_LENGTH : (i * 13) % MAX_LENGTH;
+        };
+        for (int i = 0; i < nr_of_dpus; i++) {
+            for (uint32_t j = 0; j < MAX_LENGTH; j++) {
+                dpuBuffer[i][j] = (uint8_t)(i * 7 + j);
+            }
+            uint64_t size = i == 1 ? 1 << 20 : expectedSize(i);
+            memcpy(dpuBuffer[i] + MAX_LENGTH, &size, sizeof(size));
+        }
+        pimInterface.SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, MAX_LENGTH, false);
+        pimInterface.SendToPIM(dpuBuffer, MAX_LENGTH, DPU_MRAM_HEAP_POINTER_NAME, SIZE_OFFSET,
+                               sizeof(uint64_t), false);
+        PIMRaggedResult ragged = pimInterface.ReceiveRaggedFromPIM(
+            DPU_MRAM_HEAP_POINTER_NAME, SIZE_OFFSET, DPU_MRAM_HEAP_POINTER_NAME, 0, MAX_LENGTH);
+        for (int i = 0; i < nr_of_dpus; i++) {
+            assert(ragged.sizes[i] == expectedSize(i));
+            assert(ragged.offsets[i] % sizeof(uint64_t) == 0);
+            assert(ragged.offsets[i + 1] - ragged.offsets[i] >= ragged.sizes[i]);
+            assert(memcmp(ragged.data.get() + ragged.offsets[i], dpuBuffer[i],
+                          ragged.sizes[i]) == 0);
+        }
+    }
+
+    // Disk -> PIM.MRAM : shards of unequal sizes through a mapped file. A
+    // short shard is followed by zeros up to written[i], then by MRAM the
+    // load must not touch.
+    {
+        const uint32_t SHARD_OFFSET = 2 << 20, MAX_SHARD = 200000, CHECK_SIZE = MAX_SHARD + (64 << 10);
+        const uint8_t UNTOUCHED = 0xee;
+        const char *path = "/tmp/pim_example_shards.bin";
+        vector<uint64_t> shardLengths(nr_of_dpus);
+        for (int i = 0; i < nr_of_dpus; i++) {
+            shardLengths[i] = ((i * 37) % 200) * 1000 + i % 3;
+            memset(dpuBuffer[i], UNTOUCHED, CHECK_SIZE);
+        }
+        pimInterface.SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, SHARD_OFFSET, CHECK_SIZE, false);
+        auto shardByte = [](int i, uint64_t j) { return (uint8_t)(j * 3 + i); };
+        for (int i = 0; i < nr_of_dpus; i++) {
+            for (uint64_t j = 0; j < shardLengths[i]; j++) {
+                dpuBuffer[i][j] = shardByte(i, j);
+            }
+        }
+        bool written = WritePIMShardFile(path, dpuBuffer, shardLengths.data(), nr_of_dpus);
+        assert(written);
+        (void)written;
+
+        PIMShardLoader loader(&pimInterface, 64 << 10);
+        PIMShardLoadResult loaded;
+        bool ok = loader.Load(path, SHARD_OFFSET, loaded);
+        assert(ok);
+        auto checkShards = [&]() {
+            pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, SHARD_OFFSET, CHECK_SIZE, false);
+            bool paddedShard = false;
+            for (int i = 0; i < nr_of_dpus; i++) {
+                uint64_t padded = (shardLengths[i] + 7) / 8 * 8;
+                assert(loaded.lengths[i] == padded);
+                assert(loaded.written[i] >= padded && loaded.written[i] <= MAX_SHARD + 8);
+                paddedShard |= loaded.written[i] > padded;
+                for (uint64_t j = 0; j < CHECK_SIZE; j++) {
+                    uint8_t expected = j < shardLengths[i] ? shardByte(i, j)
+                                       : j < loaded.written[i] ? 0 : UNTOUCHED;
+                    assert(dpuBuffer[i][j] == expected);
+                }
+            }
+            assert(paddedShard);
+        };
+        checkShards();
+
+        // A truncated file, a foreign one and a missing one are refused
+        // before any MRAM is written.
+        struct stat st;
+        int status = stat(path, &st);
+        assert(status == 0);
+        status = truncate(path, st.st_size - sizeof(uint64_t));
+        assert(status == 0);
+        PIMShardLoadResult refused;
+        ok = loader.Load(path, SHARD_OFFSET, refused);
+        assert(!ok);
+        FILE *file = fopen(path, "r+b");
+        assert(file != nullptr);
+        fputc('X', file);
+        fclose(file);
+        status = truncate(path, st.st_size);
+        assert(status == 0);
+        (void)status;
+        ok = loader.Load(path, SHARD_OFFSET, refused);
+        assert(!ok);
+        unlink(path);
+        ok = loader.Load(path, SHARD_OFFSET, refused);
+        assert(!ok);
+        (void)ok;
+        checkShards();
+    }
+
+    // PIM.MRAM -> Disk -> PIM.MRAM : save, clobber and restore a heap range,
+    // in full and skipping blocks that are zero on every DPU. A corrupted
+    // or missing snapshot must leave the MRAM untouched.
+    {
+        const uint32_t SNAP_OFFSET = 3 << 20, SNAP_LENGTH = (160 << 10) + 520;
+        const uint8_t CLOBBER = 0xcc;
+        const string dir = "/tmp/pim_example_snapshot";
+        // Blocks 1, 4, ... are zero on every DPU, blocks 2, 5, ... on even DPUs.
+        auto snapByte = [](int i, uint64_t j) -> uint8_t {
+            uint64_t b = j / PIMSnapshot::BLOCK_SIZE;
+            return b % 3 == 1 || (b % 3 == 2 && i % 2 == 0) ? 0 : (uint8_t)(j * 5 + i) | 1;
+        };
+        auto fillAndSend = [&](bool pattern) {
+            for (int i = 0; i < nr_of_dpus; i++) {
+                for (uint64_t j = 0; j < SNAP_LENGTH; j++) {
+                    dpuBuffer[i][j] = pattern ? snapByte(i, j) : CLOBBER;
+                }
+            }
+            pimInterface.SendToPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, SNAP_OFFSET, SNAP_LENGTH, false);
+        };
+        auto check = [&](auto expected) {
+            pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, SNAP_OFFSET, SNAP_LENGTH, false);
+            for (int i = 0; i < nr_of_dpus; i++) {
+                for (uint64_t j = 0; j < SNAP_LENGTH; j++) {
+                    assert(dpuBuffer[i][j] == expected(i, j));
+                }
+            }
+        };
+
+        PIMSnapshot snapshot(&pimInterface, 64 << 10);
+        fillAndSend(true);
+        bool saved = snapshot.Save("/proc/pim_example_snapshot", SNAP_OFFSET, SNAP_LENGTH);
+        assert(!saved);
+        saved = snapshot.Save(dir, SNAP_OFFSET, SNAP_LENGTH);
+        assert(saved);
+        (void)saved;
+
+        fillAndSend(false);
+        bool restored = snapshot.Restore(dir);
+        assert(restored);
+        check(snapByte);
+
+        fillAndSend(false);
+        restored = snapshot.Restore(dir, true);
+        assert(restored);
+        check([&](int i, uint64_t j) {
+            return (j / PIMSnapshot::BLOCK_SIZE) % 3 == 1 ? CLOBBER : snapByte(i, j);
+        });
+
+        // Flip a byte of the first block of DPU 0, which is not zero.
+        string rank0 = dir + "/rank_0.snap";
+        FILE *file = fopen(rank0.c_str(), "r+b");
+        assert(file != nullptr);
+        long position = sizeof(PIMSnapshotHeader) + sizeof(PIMSnapshotBlock) + 100;
+        fseek(file, position, SEEK_SET);
+        int byte = fgetc(file);
+        fseek(file, position, SEEK_SET);
+        fputc(byte ^ 0xff, file);
+        fclose(file);
+        fillAndSend(false);
+        restored = snapshot.Restore(dir);
+        assert(!restored);
+        restored = snapshot.Restore(dir + "_missing");
+        assert(!restored);
+        check([&](int, uint64_t) { return CLOBBER; });
+        (void)restored;
+
+        for (uint32_t r = 0; r < pimInterface.GetNrOfRanks(); r++) {
+            unlink((dir + "/rank_" + to_string(r) + ".snap").c_str());
+        }
+        rmdir(dir.c_str());
+    }
+
     // Execute : will call the UPMEM interface.
     pimInterface.Launch(false);
     pimInterface.PrintLog([](int i){return (i % 100) == 0;});
 
+    // Logs into a callback and into a ring that keeps only the newest.
+    {
+        vector<uint32_t> order;
+        pimInterface.CollectLog([](int) { return true; },
+                                [&](uint32_t dpu_id, const string &) { order.push_back(dpu_id); });
+        assert((int)order.size() == nr_of_dpus);
+        for (int i = 0; i < nr_of_dpus; i++) {
+            assert(order[i] == (uint32_t)i);
+        }
+
+        const size_t RING_CAPACITY = 3;
+        PIMLogRingSink ring(RING_CAPACITY);
+        pimInterface.CollectLog([](int) { return true; }, ring);
+        auto entries = ring.Drain();
+        assert(entries.size() == min(RING_CAPACITY, (size_t)nr_of_dpus));
+        for (size_t k = 0; k < entries.size(); k++) {
+            uint32_t dpu_id = nr_of_dpus - entries.size() + k;
+            assert(entries[k].first == dpu_id);
+            string expected = "DPU ID is " + to_string(dpu_id) + "!";
+            assert(entries[k].second.find(expected) != string::npos);
+        }
+        assert(ring.Drain().empty());
+    }
+
+    // Rank groups : two halves of the ranks, each driven from its own thread
+    // with its own worker pool; the whole interface then reads back what
+    // both wrote.
+    {
+        const uint32_t GROUP_SIZE = 1 << 20;
+        DirectPIMInterface *groups[2] = {
+            pimInterface.CreateRankGroup(0, NR_RANKS / 2, 8),
+            pimInterface.CreateRankGroup(NR_RANKS / 2, NR_RANKS, 8)};
+        uint32_t firstDPU[2] = {0, groups[0]->GetNrOfDPUs()};
+        assert((int)(firstDPU[1] + groups[1]->GetNrOfDPUs()) == nr_of_dpus);
+        auto Pattern = [](uint32_t g, size_t i, size_t j) {
+            return (uint8_t)(j ^ (i * 7) ^ (g + 1));
+        };
+        vector<thread> threads;
+        for (uint32_t g = 0; g < 2; g++) {
+            threads.emplace_back([&, g]() {
+                DirectPIMInterface *group = groups[g];
+                uint8_t **buffers = dpuBuffer + firstDPU[g];
+                size_t nrOfDPUs = group->GetNrOfDPUs();
+                group->ParallelFor(0, nrOfDPUs, [&](size_t i) {
+                    for (size_t j = 0; j < GROUP_SIZE; j++) {
+                        buffers[i][j] = Pattern(g, i, j);
+                    }
+                });
+                group->SendToPIM(buffers, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, GROUP_SIZE, false);
+                group->Launch(false);
+                group->ParallelFor(0, nrOfDPUs, [&](size_t i) {
+                    memset(buffers[i], 0, GROUP_SIZE);
+                });
+                group->ReceiveFromPIM(buffers, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, GROUP_SIZE, false);
+                group->ParallelFor(0, nrOfDPUs, [&](size_t i) {
+                    for (size_t j = 0; j < GROUP_SIZE; j++) {
+                        assert(buffers[i][j] == Pattern(g, i, j));
+                    }
+                });
+            });
+        }
+        for (thread &t : threads) {
+            t.join();
+        }
+        delete groups[0];
+        delete groups[1];
+
+        for (int i = 0; i < nr_of_dpus; i++) {
+            memset(dpuBuffer[i], 0, GROUP_SIZE);
+        }
+        pimInterface.ReceiveFromPIM(dpuBuffer, 0, DPU_MRAM_HEAP_POINTER_NAME, 0, GROUP_SIZE, false);
+        parlay::parallel_for(0, nr_of_dpus, [&](size_t i) {
+            uint32_t g = i >= firstDPU[1];
+            for (size_t j = 0; j < GROUP_SIZE; j++) {
+                assert(dpuBuffer[i][j] == Pattern(g, i - firstDPU[g], j));
+            }
+        });
+    }
+
+    // Switching programs: what dpu_example wrote to WRAM at run time must
+    // not show up in the zero-initialized globals of the next program.
+    {
+        PIMProgramCache cache(&pimInterface);
+        size_t exampleKernel = cache.Add("dpu_example");
+        size_t zeroKernel = cache.Add("dpu_example_zero");
+        cache.Switch(exampleKernel);
+        pimInterface.Launch(false);
+        const uint32_t SWITCH_TEST_SIZE = SWITCH_TEST_WORDS * sizeof(uint64_t);
+        pimInterface.ReceiveFromPIM(dpuBuffer, 0, "SCRATCH", 0, SWITCH_TEST_SIZE, false);
+        for (int i = 0; i < nr_of_dpus; i++) {
+            assert(((uint64_t *)dpuBuffer[i])[1] == 0xa5a5a5a500000001ull);
+        }
+
+        cache.Switch(zeroKernel);
+        pimInterface.ReceiveFromPIM(dpuBuffer, 0, "ZEROED", 0, SWITCH_TEST_SIZE, false);
+        for (int i = 0; i < nr_of_dpus; i++) {
+            for (int k = 0; k < SWITCH_TEST_WORDS; k++) {
+                assert(((uint64_t *)dpuBuffer[i])[k] == 0);
+            }
+        }
+    }
+
     for (int i = 0; i < nr_of_dpus; i++) {
         delete [] dpuIDs[i];
         delete [] dpuBuffer[i];
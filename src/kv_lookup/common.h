@@ -0,0 +1,11 @@
+#pragma once
+
+// 128-byte stream blocks: 16 keys per tasklet step, so that a few hundred
+// queries per DPU already keep every tasklet busy
+#define MRAM_STREAM_BLOCK_SIZE 128
+#include "mram_stream_layout.h"
+#include "kv_lookup_layout.h"
+
+// MRAM heap handed to the allocator with the UPMEM interface; the direct
+// interface reads the real size from the program
+#define KV_HEAP_SIZE (48 << 20)
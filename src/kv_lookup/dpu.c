@@ -0,0 +1,69 @@
+#include <defs.h>
+#include <mram.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "mram_regions.h"
+#include "mram_stream.h"
+
+// Answers the batch in KV_BATCH_REGION from the table in KV_TABLE_REGION,
+// see kv_lookup_layout.h. Tasklets take 16-key blocks of the batch in turn
+// and overwrite every key with its value.
+
+typedef struct {
+    __mram_ptr kv_entry_t *entries;
+    uint32_t mask;  // capacity - 1
+} kv_table_t;
+
+__dma_aligned kv_entry_t probe_window[NR_TASKLETS][KV_PROBE_WINDOW];
+
+// Linear probing from the home slot, KV_PROBE_WINDOW slots per MRAM read.
+static uint64_t kv_lookup(const kv_table_t *table, uint64_t key) {
+    kv_entry_t *window = probe_window[me()];
+    uint32_t slot = kv_hash(key) & table->mask;
+    for (uint32_t probed = 0; probed <= table->mask;) {
+        uint32_t n = table->mask + 1 - slot;
+        if (n > KV_PROBE_WINDOW) {
+            n = KV_PROBE_WINDOW;
+        }
+        mram_read(table->entries + slot, window, n * sizeof(kv_entry_t));
+        for (uint32_t i = 0; i < n; i++) {
+            if (window[i].key == key) {
+                return window[i].value;
+            }
+            if (window[i].key == KV_EMPTY_KEY) {
+                return KV_MISSING_VALUE;
+            }
+        }
+        probed += n;
+        slot = (slot + n) & table->mask;
+    }
+    return KV_MISSING_VALUE;
+}
+
+void lookup_block(uint8_t *wram, uint32_t size, uint32_t offset, void *arg) {
+    (void)offset;
+    const kv_table_t *table = (const kv_table_t *)arg;
+    uint64_t *keys = (uint64_t *)wram;
+    for (uint32_t i = 0; i < size / sizeof(uint64_t); i++) {
+        keys[i] = kv_lookup(table, keys[i]);
+    }
+}
+
+int main() {
+    __mram_ptr uint8_t *table_data =
+        mram_region_address(mram_region_find(KV_TABLE_REGION));
+    __mram_ptr uint8_t *batch =
+        mram_region_address(mram_region_find(KV_BATCH_REGION));
+
+    kv_table_t table;
+    table.entries =
+        (__mram_ptr kv_entry_t *)(table_data + sizeof(kv_table_header_t));
+    table.mask = ((__mram_ptr kv_table_header_t *)table_data)->capacity - 1;
+    uint32_t nr_of_queries =
+        ((__mram_ptr kv_batch_header_t *)batch)->nr_of_queries;
+
+    mram_stream_map(batch + sizeof(kv_batch_header_t),
+                    nr_of_queries * sizeof(uint64_t), lookup_block, &table);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <parlay/parallel.h>
+#include <parlay/utilities.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "kv_lookup.hpp"
+#include "mram_allocator.hpp"
+#include "pim_interface_header.hpp"
+using namespace std;
+
+// Table keys are the odd numbers 1, 3, ..., 2n - 1; queries draw from
+// [1, 2n], so about half of them miss.
+const uint64_t VALUE_MASK = 0x5555555555555555ull;
+
+uint64_t QueryKey(uint64_t nr_of_keys, uint64_t round, uint64_t i) {
+    return parlay::hash64((round << 40) ^ i) % (2 * nr_of_keys) + 1;
+}
+
+uint64_t ExpectedValue(uint64_t nr_of_keys, uint64_t key) {
+    return (key % 2 == 1 && key < 2 * nr_of_keys) ? key ^ VALUE_MASK
+                                                   : KV_MISSING_VALUE;
+}
+
+// Latency and throughput of Lookup for batches of 1 to 4096 queries per DPU
+// on average, each batch size repeated for about a second.
+void BenchmarkLookups(PIMInterface *interface, PIMKVStore &store,
+                      uint64_t nr_of_keys, uint32_t nr_of_ranks) {
+    const double timeLimitPerTest = 1.0;
+    const size_t repeatLimitPerTest = 1000;
+    uint32_t nrOfDPUs = interface->GetNrOfDPUs();
+
+    printf("%12s %10s %7s %12s %12s %14s\n", "batch", "per DPU", "rounds",
+           "latency ms", "Mqueries/s", "Mqueries/s/rank");
+    for (uint64_t perDPU = 1; perDPU <= 4096; perDPU *= 4) {
+        uint64_t batch = perDPU * nrOfDPUs;
+        vector<uint64_t> keys(batch), values(batch);
+        double elapsed = 0;
+        size_t repeat = 0;
+        for (; repeat < repeatLimitPerTest && elapsed < timeLimitPerTest;
+             repeat++) {
+            parlay::parallel_for(0, batch, [&](size_t i) {
+                keys[i] = QueryKey(nr_of_keys, repeat, i);
+            });
+            auto start = chrono::steady_clock::now();
+            store.Lookup(keys.data(), batch, values.data());
+            chrono::duration<double> d = chrono::steady_clock::now() - start;
+            elapsed += d.count();
+            if (repeat == 0) {
+                parlay::parallel_for(0, batch, [&](size_t i) {
+                    assert(values[i] == ExpectedValue(nr_of_keys, keys[i]));
+                });
+            }
+        }
+        double qps = batch * repeat / elapsed;
+        printf("%12lu %10lu %7u %12.3lf %12.3lf %14.3lf\n", batch, perDPU,
+               store.GetNrOfRounds(), elapsed / repeat * 1e3, qps / 1e6,
+               qps / 1e6 / nr_of_ranks);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr,
+                "Usage: %s <nr_ranks> <Interface Type> [keys per DPU]\n",
+                argv[0]);
+        exit(1);
+    }
+    int nr_ranks;
+    sscanf(argv[1], "%d", &nr_ranks);
+    string interfaceType = argv[2];
+    uint64_t keysPerDPU = argc > 3 ? stoull(argv[3]) : 1 << 16;
+    if (interfaceType != "direct" && interfaceType != "UPMEM") {
+        fprintf(stderr,
+                "Invalid interface type. Please enter either 'direct' or "
+                "'UPMEM'.\n");
+        exit(1);
+    }
+
+    PIMInterface *pimInterface;
+    uint32_t heapSize;
+    if (interfaceType == "direct") {
+        DirectPIMInterface *direct =
+            new DirectPIMInterface(nr_ranks, "dpu_kv_lookup");
+        heapSize = direct->GetMRAMHeapSize();
+        pimInterface = direct;
+    } else {
+        pimInterface = new UPMEMInterface(nr_ranks, "dpu_kv_lookup");
+        heapSize = KV_HEAP_SIZE;
+    }
+
+    PIMMRAMAllocator allocator(pimInterface, heapSize);
+    PIMKVStore store(pimInterface, &allocator);
+
+    uint64_t nr_of_keys = keysPerDPU * pimInterface->GetNrOfDPUs();
+    vector<uint64_t> keys(nr_of_keys), values(nr_of_keys);
+    parlay::parallel_for(0, nr_of_keys, [&](size_t i) {
+        keys[i] = 2 * i + 1;
+        values[i] = keys[i] ^ VALUE_MASK;
+    });
+    auto start = chrono::steady_clock::now();
+    store.Build(keys.data(), values.data(), nr_of_keys);
+    chrono::duration<double> buildTime = chrono::steady_clock::now() - start;
+    printf("Built %lu keys on %u DPUs (%u slots per DPU) in %.3lf s\n",
+           nr_of_keys, pimInterface->GetNrOfDPUs(), store.GetCapacityPerDPU(),
+           buildTime.count());
+
+    BenchmarkLookups(pimInterface, store, nr_of_keys,
+                     pimInterface->GetNrOfRanks());
+
+    delete pimInterface;
+    return 0;
+}
@@ -1,12 +1,27 @@
 #pragma once
 
 #include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <x86intrin.h>
 
+#include <algorithm>
 #include <cinttypes>
+#include <cstring>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "mram_address.hpp"
 #include "pim_interface.hpp"
+#include "pim_reduce.hpp"
+#include "pim_trace.hpp"
+#include "transfer_parameters.hpp"
 #include "parlay/parallel.h"
 #include "parlay/internal/sequence_ops.h"
 
@@ -47,6 +62,39 @@ typedef struct _hw_dpu_rank_allocation_parameters_t {
 } *hw_dpu_rank_allocation_parameters_t;
 }
 
+// Output of DirectPIMInterface::ReceiveRaggedFromPIM: DPU i produced sizes[i] bytes,
+// stored at data[offsets[i]]. Offsets are padded to 8 bytes.
+struct PIMRaggedResult {
+    std::unique_ptr<uint8_t[]> data;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> sizes;
+};
+
+// One MRAM transfer of DirectPIMInterface::ExecuteBatch: `length` bytes
+// between `buffers[dpu] + buffer_offset` and `symbol_name + symbol_offset`.
+struct PIMTransferCommand {
+    bool send;
+    uint8_t **buffers;
+    uint32_t buffer_offset;
+    std::string symbol_name;
+    uint32_t symbol_offset;
+    uint32_t length;
+};
+
+// Inbox header entry written by DirectPIMInterface::AllToAll, one per source
+// DPU: its bytes for this DPU start `offset` bytes after the inbox start.
+struct PIMAllToAllEntry {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// IRAM and WRAM contents of a DPU right after its program was loaded.
+// Sizes are trimmed to the last non-zero instruction / word.
+struct PIMProgramImage {
+    std::vector<dpuinstruction_t> iram;
+    std::vector<dpuword_t> wram;
+};
+
 class DirectPIMInterface : public PIMInterface {
    protected:
     void load_from_dpu_set(dpu_set_t dpu_set) {
@@ -54,6 +102,14 @@ class DirectPIMInterface : public PIMInterface {
         params = new hw_dpu_rank_allocation_parameters_t[nr_of_ranks];
         base_addrs = new uint8_t *[nr_of_ranks];
         program = nullptr;
+        // Spread idle workers over the ranks; at least one task per group.
+        // A machine profile may override this and the kernel parameters.
+        nr_of_tasks_per_rank = std::max(
+            (uint32_t)4, (uint32_t)(parlay::num_workers() / nr_of_ranks));
+        transfer_parameters.LoadDefault();
+        if (transfer_parameters.nr_of_tasks_per_rank != 0) {
+            nr_of_tasks_per_rank = transfer_parameters.nr_of_tasks_per_rank;
+        }
         for (uint32_t i = 0; i < nr_of_ranks; i++) {
             ranks[i] = dpu_set.list.ranks[i];
             params[i] =
@@ -66,8 +122,10 @@ class DirectPIMInterface : public PIMInterface {
         // find rank ID for each DPU
         {
             rankIDOfDPU = new size_t[nr_of_dpus];
+            firstDPUIDOfRank = new size_t[nr_of_ranks + 1];
             size_t dpu_id = 0;
             for (size_t i = 0; i < nr_of_ranks; i ++) {
+                firstDPUIDOfRank[i] = dpu_id;
                 for (size_t j = 0; j < MAX_NR_DPUS_PER_RANK; j ++) {
                     if (ranks[i]->dpus[j].enabled) {
                         rankIDOfDPU[dpu_id] = i;
@@ -76,8 +134,23 @@ class DirectPIMInterface : public PIMInterface {
                 }
             }
             assert((dpu_id == nr_of_dpus) && "DPU ID mismatch");
+            firstDPUIDOfRank[nr_of_ranks] = nr_of_dpus;
+            dpuIDOfSlot.assign(nr_of_ranks * MAX_NR_DPUS_PER_RANK, -1);
+            rankFullyEnabled.assign(nr_of_ranks, 1);
+            dpu_id = 0;
+            for (size_t i = 0; i < nr_of_ranks; i ++) {
+                for (size_t j = 0; j < MAX_NR_DPUS_PER_RANK; j ++) {
+                    if (ranks[i]->dpus[j].enabled) {
+                        dpuIDOfSlot[i * MAX_NR_DPUS_PER_RANK + j] = dpu_id ++;
+                    } else {
+                        rankFullyEnabled[i] = 0;
+                    }
+                }
+            }
         }
         // find program pointer
+        dpu_set_t dpu;
+        uint32_t each_dpu;
         DPU_FOREACH(dpu_set, dpu, each_dpu) {
             assert(dpu.kind == DPU_SET_DPU);
             dpu_t *dpuptr = dpu.dpu;
@@ -92,80 +165,159 @@ class DirectPIMInterface : public PIMInterface {
         }
     }
 
+    uint64_t GetEnabledMaskOfRank(size_t rank_id) {
+        uint64_t mask = 0;
+        for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+            if (ranks[rank_id]->dpus[j].enabled) {
+                mask |= 1ull << j;
+            }
+        }
+        return mask;
+    }
+
+    // Spread per-DPU buffers over MAX_NR_DPUS_PER_RANK slots per rank, with
+    // nullptr for disabled DPUs.
+    void AlignBuffers(uint8_t **buffers, uint32_t buffer_offset,
+                      uint8_t **buffers_aligned) {
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < nr_of_ranks; i++) {
+            for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+                if (ranks[i]->dpus[j].enabled) {
+                    buffers_aligned[i * MAX_NR_DPUS_PER_RANK + j] =
+                        buffers[offset++] + buffer_offset;
+                } else {
+                    buffers_aligned[i * MAX_NR_DPUS_PER_RANK + j] = nullptr;
+                }
+            }
+        }
+        assert(offset == nr_of_dpus);
+    }
+
     inline bool aligned(uint64_t offset, uint64_t factor) {
         return (offset % factor == 0);
     }
 
     inline uint64_t GetCorrectOffsetMRAM(uint64_t address_offset,
                                          uint32_t dpu_id) {
-        auto FastPath = [](uint64_t address_offset, uint32_t dpu_id) {
-            uint64_t mask_move_7 =
-                (~((1 << 22) - 1)) + (1 << 13);              // 31..22, 13
-            uint64_t mask_move_6 = ((1 << 22) - (1 << 15));  // 21..15
-            uint64_t mask_move_14 = (1 << 14);               // 14
-            uint64_t mask_move_4 = (1 << 13) - 1;            // 12 .. 0
-            return ((address_offset & mask_move_7) << 7) |
-                   ((address_offset & mask_move_6) << 6) |
-                   ((address_offset & mask_move_14) << 14) |
-                   ((address_offset & mask_move_4) << 4) | (dpu_id << 18);
-        };
-
-        // not used
-        auto OraclePath = [](uint64_t address_offset, uint32_t dpu_id) {
-            // uint64_t fastoffset = get_correct_offset_fast(address_offset,
-            // dpu_id);
-            uint64_t offset = 0;
-            // 1 : address_offset < 64MB
-            offset += (512ll << 20) * (address_offset >> 22);
-            address_offset &= (1ll << 22) - 1;
-            // 2 : address_offset < 4MB
-            if (address_offset & (16 << 10)) {
-                offset += (256ll << 20);
-            }
-            offset += (2ll << 20) * (address_offset / (32 << 10));
-            address_offset %= (16 << 10);
-            // 3 : address_offset < 16K
-            if (address_offset & (8 << 10)) {
-                offset += (1ll << 20);
-            }
-            address_offset %= (8 << 10);
-            offset += address_offset * 16;
-            // 4 : address_offset < 8K
-            offset += (dpu_id & 3) * (256 << 10);
-            // 5
-            if (dpu_id >= 4) {
-                offset += 64;
-            }
-            return offset;
-        };
-        (void)OraclePath;
-
-        // uint64_t v1 = FastPath(address_offset, dpu_id);
-        // uint64_t v2 = OraclePath(address_offset, dpu_id);
+        // uint64_t v1 = TranslateMRAMAddress(address_offset, dpu_id);
+        // uint64_t v2 = TranslateMRAMAddressOracle(address_offset, dpu_id);
         // assert(v1 == v2);
         // return v1;
+        return TranslateMRAMAddress(address_offset, dpu_id);
+    }
 
-        return FastPath(address_offset, dpu_id);
+    // Flush the lines covering words [word_begin, word_end) of one dpu_id
+    // group, so that the following loads are served by the DIMM.
+    void FlushRankMRAM(uint32_t symbol_offset, uint8_t *ptr_dest,
+                       uint32_t dpu_id, uint32_t word_begin,
+                       uint32_t word_end, bool fence = true) {
+        PIM_TRACE_SCOPE("flush");
+        MRAMAddressIterator it(symbol_offset + (word_begin * 8), dpu_id);
+        for (uint32_t i = word_begin; i < word_end; ++i, ++it) {
+            // 8 shards of DPUs
+            uint64_t offset = *it;
+            __builtin_ia32_clflushopt((void *)(ptr_dest + offset));
+            offset += 0x40;
+            __builtin_ia32_clflushopt((void *)(ptr_dest + offset));
+        }
+        if (fence) {
+            __builtin_ia32_mfence();
+        }
     }
 
-    void ReceiveFromRankMRAM(uint8_t **buffers, uint32_t symbol_offset,
-                             uint8_t *ptr_dest, uint32_t length) {
-        assert(aligned(symbol_offset, sizeof(uint64_t)));
-        assert(aligned(length, sizeof(uint64_t)));
-        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
+    // Receive sinks get the de-interleaved words of one half cache line:
+    // words[j] is word i of DPU (first_dpu + j * 8) of the rank.
+    struct BufferSink {
+        uint8_t **buffers;
 
-        for (uint32_t dpu_id = 0; dpu_id < 4; ++dpu_id) {
-            for (uint32_t i = 0; i < length / sizeof(uint64_t); ++i) {
-                // 8 shards of DPUs
-                uint64_t offset =
-                    GetCorrectOffsetMRAM(symbol_offset + (i * 8), dpu_id);
-                __builtin_ia32_clflushopt((void *)(ptr_dest + offset));
-                offset += 0x40;
-                __builtin_ia32_clflushopt((void *)(ptr_dest + offset));
+        inline void Prefetch(uint32_t dpu_id, uint32_t i) {
+            for (int j = 0; j < 16; j++) {
+                __builtin_prefetch(((uint64_t *)buffers[j * 4 + dpu_id]) + i);
             }
         }
-        __builtin_ia32_mfence();
-        
+
+        inline void Store(uint32_t first_dpu, uint32_t i,
+                          const uint64_t *words) {
+            for (int j = 0; j < 8; j++) {
+                if (buffers[j * 8 + first_dpu] == nullptr) {
+                    continue;
+                }
+                *(((uint64_t *)buffers[j * 8 + first_dpu]) + i) = words[j];
+            }
+        }
+    };
+
+    // Stores word i of a DPU only while i < nr_of_words[dpu].
+    struct RaggedBufferSink {
+        uint8_t **buffers;
+        const uint32_t *nr_of_words;
+
+        inline void Prefetch(uint32_t dpu_id, uint32_t i) {
+            for (int j = 0; j < 16; j++) {
+                __builtin_prefetch(((uint64_t *)buffers[j * 4 + dpu_id]) + i);
+            }
+        }
+
+        inline void Store(uint32_t first_dpu, uint32_t i,
+                          const uint64_t *words) {
+            for (int j = 0; j < 8; j++) {
+                if (i >= nr_of_words[j * 8 + first_dpu]) {
+                    continue;
+                }
+                *(((uint64_t *)buffers[j * 8 + first_dpu]) + i) = words[j];
+            }
+        }
+    };
+
+    // Folds the words of all enabled DPUs into one partial per word.
+    // T packs 8 / sizeof(T) elements into each word.
+    template <typename T, typename Op>
+    struct ReduceSink {
+        T *partial;
+        uint64_t enabled_mask;
+        Op op;
+
+        inline void Prefetch(uint32_t, uint32_t i) {
+            __builtin_prefetch(partial + i * (sizeof(uint64_t) / sizeof(T)));
+        }
+
+        inline void Store(uint32_t first_dpu, uint32_t i,
+                          const uint64_t *words) {
+            constexpr int K = sizeof(uint64_t) / sizeof(T);
+            T *dst = partial + (size_t)i * K;
+            for (int j = 0; j < 8; j++) {
+                if (!((enabled_mask >> (j * 8 + first_dpu)) & 1)) {
+                    continue;
+                }
+                T elements[K];
+                memcpy(elements, &words[j], sizeof(uint64_t));
+                for (int e = 0; e < K; e++) {
+                    dst[e] = op(dst[e], elements[e]);
+                }
+            }
+        }
+    };
+
+    // Words [word_begin, word_end) of the 16 DPUs in group dpu_id. Tasks on
+    // disjoint groups or word ranges of one rank may run concurrently: every
+    // task flushes and fences exactly the lines it loads.
+    template <typename Sink>
+    void ReceiveFromRankMRAM(Sink &sink, uint32_t symbol_offset,
+                             uint8_t *ptr_dest, uint32_t dpu_id,
+                             uint32_t word_begin, uint32_t word_end) {
+        FlushRankMRAM(symbol_offset, ptr_dest, dpu_id, word_begin, word_end);
+        ReceiveFromRankMRAMKernel(sink, symbol_offset, ptr_dest, dpu_id,
+                                  word_begin, word_end);
+        FlushRankMRAM(symbol_offset, ptr_dest, dpu_id, word_begin, word_end);
+    }
+
+    // The loads of ReceiveFromRankMRAM; the lines must have been flushed and
+    // fenced before, and are left in the cache.
+    template <typename Sink>
+    void ReceiveFromRankMRAMKernel(Sink &sink, uint32_t symbol_offset,
+                                   uint8_t *ptr_dest, uint32_t dpu_id,
+                                   uint32_t word_begin, uint32_t word_end) {
+        PIM_TRACE_SCOPE("transpose");
         uint64_t cache_line[8], cache_line_interleave[8];
 
         auto LoadData = [](uint64_t *cache_line, uint8_t *ptr_dest) {
@@ -187,104 +339,606 @@ class DirectPIMInterface : public PIMInterface {
                                                     7 * sizeof(uint64_t)));
         };
 
-        for (uint32_t dpu_id = 0; dpu_id < 4; ++dpu_id) {
-            for (uint32_t i = 0; i < length / sizeof(uint64_t); ++i) {
-                if ((i % 8 == 0) && (i + 8 < length / sizeof(uint64_t))) {
-                    for (int j = 0; j < 16; j++) {
-                        __builtin_prefetch(
-                            ((uint64_t *)buffers[j * 4 + dpu_id]) + i + 8);
-                    }
+        const uint32_t mram_prefetch = transfer_parameters.mram_prefetch_words;
+        const uint32_t buffer_prefetch =
+            transfer_parameters.buffer_prefetch_words;
+        MRAMAddressIterator it(symbol_offset + (word_begin * 8), dpu_id);
+        MRAMAddressIterator it_prefetch(
+            symbol_offset + ((word_begin + mram_prefetch) * 8), dpu_id);
+        for (uint32_t i = word_begin; i < word_end;
+             ++i, ++it, ++it_prefetch) {
+            if ((i % 8 == 0) && (i + buffer_prefetch < word_end)) {
+                sink.Prefetch(dpu_id, i + buffer_prefetch);
+            }
+            uint64_t offset = *it;
+            if (i + mram_prefetch < word_end) {
+                uint64_t offset_prefetch = *it_prefetch;
+                __builtin_prefetch(ptr_dest + offset_prefetch);
+                __builtin_prefetch(ptr_dest + offset_prefetch + 0x40);
+            }
+            // __builtin_prefetch(ptr_dest + offset + 0x40 * 6);
+            // __builtin_prefetch(ptr_dest + offset + 0x40 * 7);
+
+            LoadData(cache_line, ptr_dest + offset);
+            byte_interleave_avx512(cache_line, cache_line_interleave, false);
+            sink.Store(dpu_id, i, cache_line_interleave);
+
+            offset += 0x40;
+            LoadData(cache_line, ptr_dest + offset);
+            byte_interleave_avx512(cache_line, cache_line_interleave, false);
+            sink.Store(dpu_id + 4, i, cache_line_interleave);
+        }
+    }
+
+    void ReceiveFromRankMRAM(uint8_t **buffers, uint32_t symbol_offset,
+                             uint8_t *ptr_dest, uint32_t dpu_id,
+                             uint32_t word_begin, uint32_t word_end) {
+        BufferSink sink{buffers};
+        ReceiveFromRankMRAM(sink, symbol_offset, ptr_dest, dpu_id, word_begin,
+                            word_end);
+    }
+
+    // Send sources fill one half cache line: words[j] is word i of DPU
+    // (first_dpu + j * 8) of the rank.
+    struct BufferSource {
+        uint8_t **buffers;
+
+        inline void Prefetch(uint32_t dpu_id, uint32_t i) {
+            for (int j = 0; j < 16; j++) {
+                __builtin_prefetch(((uint64_t *)buffers[j * 4 + dpu_id]) + i);
+            }
+        }
+
+        inline void Load(uint32_t first_dpu, uint32_t i, uint64_t *words) {
+            for (int j = 0; j < 8; j++) {
+                if (buffers[j * 8 + first_dpu] == nullptr) {
+                    continue;
                 }
-                uint64_t offset =
-                    GetCorrectOffsetMRAM(symbol_offset + (i * 8), dpu_id);
-                if (i + 3 < length / sizeof(uint64_t)) {
-                    uint64_t offset_prefetch = GetCorrectOffsetMRAM(
-                        symbol_offset + ((i + 3) * 8), dpu_id);
-                    __builtin_prefetch(ptr_dest + offset_prefetch);
-                    __builtin_prefetch(ptr_dest + offset_prefetch + 0x40);
-                }
-                // __builtin_prefetch(ptr_dest + offset + 0x40 * 6);
-                // __builtin_prefetch(ptr_dest + offset + 0x40 * 7);
-
-                LoadData(cache_line, ptr_dest + offset);
-                byte_interleave_avx512(cache_line, cache_line_interleave, false);
-                for (int j = 0; j < 8; j++) {
-                    if (buffers[j * 8 + dpu_id] == nullptr) {
-                        continue;
-                    }
-                    *(((uint64_t *)buffers[j * 8 + dpu_id]) + i) =
-                        cache_line_interleave[j];
+                words[j] = *(((uint64_t *)buffers[j * 8 + first_dpu]) + i);
+            }
+        }
+    };
+
+    // Word i of a DPU only while i < nr_of_words[dpu], zero after that.
+    struct RaggedBufferSource {
+        uint8_t **buffers;
+        const uint32_t *nr_of_words;
+
+        inline void Prefetch(uint32_t dpu_id, uint32_t i) {
+            for (int j = 0; j < 16; j++) {
+                if (i < nr_of_words[j * 4 + dpu_id]) {
+                    __builtin_prefetch(((uint64_t *)buffers[j * 4 + dpu_id]) +
+                                       i);
                 }
+            }
+        }
 
-                offset += 0x40;
-                LoadData(cache_line, ptr_dest + offset);
-                byte_interleave_avx512(cache_line, cache_line_interleave, false);
-                for (int j = 0; j < 8; j++) {
-                    if (buffers[j * 8 + dpu_id + 4] == nullptr) {
-                        continue;
-                    }
-                    *(((uint64_t *)buffers[j * 8 + dpu_id + 4]) + i) =
-                        cache_line_interleave[j];
+        inline void Load(uint32_t first_dpu, uint32_t i, uint64_t *words) {
+            for (int j = 0; j < 8; j++) {
+                words[j] = i < nr_of_words[j * 8 + first_dpu]
+                               ? *(((uint64_t *)buffers[j * 8 + first_dpu]) + i)
+                               : 0;
+            }
+        }
+    };
+
+    // Records scattered by ScatterToPIM: DPU slot s receives
+    // records[order[begin[s]]], records[order[begin[s] + 1]], ... word by
+    // word, and zeros past its nr_of_words[s].
+    template <typename Record>
+    struct ScatterSource {
+        static constexpr uint32_t WORDS = sizeof(Record) / sizeof(uint64_t);
+        const Record *records;
+        const uint32_t *order;
+        const uint64_t *begin;
+        const uint32_t *nr_of_words;
+
+        inline const uint64_t *Word(uint32_t slot, uint32_t i) {
+            return (const uint64_t *)(records + order[begin[slot] + i / WORDS]) +
+                   i % WORDS;
+        }
+
+        inline void Prefetch(uint32_t dpu_id, uint32_t i) {
+            for (int j = 0; j < 16; j++) {
+                if (i < nr_of_words[j * 4 + dpu_id]) {
+                    __builtin_prefetch(Word(j * 4 + dpu_id, i));
                 }
             }
         }
 
-        for (uint32_t dpu_id = 0; dpu_id < 4; ++dpu_id) {
-            for (uint32_t i = 0; i < length / sizeof(uint64_t); ++i) {
-                // 8 shards of DPUs
-                uint64_t offset =
-                    GetCorrectOffsetMRAM(symbol_offset + (i * 8), dpu_id);
-                __builtin_ia32_clflushopt((void *)(ptr_dest + offset));
-                offset += 0x40;
+        inline void Load(uint32_t first_dpu, uint32_t i, uint64_t *words) {
+            for (int j = 0; j < 8; j++) {
+                uint32_t slot = j * 8 + first_dpu;
+                if (i < nr_of_words[slot]) {
+                    memcpy(&words[j], Word(slot, i), sizeof(uint64_t));
+                } else {
+                    words[j] = 0;
+                }
+            }
+        }
+    };
+
+    // Words produced by SendGeneratedToPIM's generator, one cache line per
+    // DPU at a time: the first load of a line fills it for the slot, the
+    // transpose consumes it while it is still in L1.
+    template <typename Generator>
+    struct GeneratorSource {
+        Generator &generator;
+        const int32_t *dpu_ids;  // DPU ID of each slot of the rank, or -1
+        uint32_t nr_of_words;
+        uint32_t line_begin[MAX_NR_DPUS_PER_RANK];
+        uint64_t line[MAX_NR_DPUS_PER_RANK][8];
+
+        GeneratorSource(Generator &generator, const int32_t *dpu_ids,
+                        uint32_t nr_of_words)
+            : generator(generator), dpu_ids(dpu_ids), nr_of_words(nr_of_words) {
+            std::fill(line_begin, line_begin + MAX_NR_DPUS_PER_RANK,
+                      UINT32_MAX);
+        }
+
+        inline void Prefetch(uint32_t, uint32_t) {}
+
+        inline void Load(uint32_t first_dpu, uint32_t i, uint64_t *words) {
+            uint32_t begin = i / 8 * 8;
+            for (int j = 0; j < 8; j++) {
+                uint32_t slot = j * 8 + first_dpu;
+                if (dpu_ids[slot] < 0) {
+                    words[j] = 0;
+                    continue;
+                }
+                if (line_begin[slot] != begin) {
+                    line_begin[slot] = begin;
+                    generator((uint32_t)dpu_ids[slot], begin,
+                              std::min((uint32_t)8, nr_of_words - begin),
+                              line[slot]);
+                }
+                words[j] = line[slot][i % 8];
+            }
+        }
+    };
+
+    // Inbox words of one all-to-all round for the DPU slots of a destination
+    // rank: the segments of the round's 64 source slots for each DPU, back to
+    // back, then zeros. Words must be loaded in order from Seek's position.
+    struct AllToAllSource {
+        struct Cursor {
+            uint32_t source;
+            uint32_t remaining;
+            const uint64_t *ptr;
+        };
+
+        const uint32_t *lengths;          // [source dpu * stride + dest dpu]
+        const uint32_t *segment_offsets;  // same layout, into the outbox data
+        uint32_t stride;
+        const int32_t *source_dpus;       // DPU ID of each source slot, or -1
+        const int32_t *dest_dpus;         // DPU ID of each dest slot, or -1
+        uint8_t *const *staging;          // outbox data of each source slot
+        Cursor cursor[MAX_NR_DPUS_PER_RANK];
+
+        // Point the cursor of slot at the next source segment that is not
+        // empty, skipping `skip` words.
+        inline void Advance(uint32_t slot, uint32_t skip) {
+            Cursor &c = cursor[slot];
+            int32_t d = dest_dpus[slot];
+            for (; c.source < MAX_NR_DPUS_PER_RANK; c.source++) {
+                int32_t s = source_dpus[c.source];
+                if (d < 0 || s < 0) {
+                    continue;
+                }
+                size_t k = (size_t)s * stride + d;
+                uint32_t words = lengths[k] / sizeof(uint64_t);
+                if (words > skip) {
+                    c.ptr = (const uint64_t *)(staging[c.source] +
+                                               segment_offsets[k]) + skip;
+                    c.remaining = words - skip;
+                    return;
+                }
+                skip -= words;
+            }
+            c.remaining = 0;
+        }
+
+        void Seek(uint32_t dpu_id, uint32_t word_begin) {
+            for (int j = 0; j < 16; j++) {
+                cursor[j * 4 + dpu_id].source = 0;
+                Advance(j * 4 + dpu_id, word_begin);
+            }
+        }
+
+        inline void Prefetch(uint32_t dpu_id, uint32_t) {
+            for (int j = 0; j < 16; j++) {
+                const Cursor &c = cursor[j * 4 + dpu_id];
+                if (c.remaining > 8) {
+                    __builtin_prefetch(c.ptr + 8);
+                }
+            }
+        }
+
+        inline void Load(uint32_t first_dpu, uint32_t, uint64_t *words) {
+            for (int j = 0; j < 8; j++) {
+                Cursor &c = cursor[j * 8 + first_dpu];
+                if (c.remaining == 0) {
+                    words[j] = 0;
+                    continue;
+                }
+                words[j] = *c.ptr++;
+                if (--c.remaining == 0) {
+                    c.source++;
+                    Advance(j * 8 + first_dpu, 0);
+                }
+            }
+        }
+    };
+
+    // Stores of SendToRankMRAM, not fenced. Without streaming stores every
+    // line is flushed to the rank right after it is written.
+    template <bool STREAM, typename Source>
+    void SendToRankMRAMKernel(Source &source, uint32_t symbol_offset,
+                              uint8_t *ptr_dest, uint32_t dpu_id,
+                              uint32_t word_begin, uint32_t word_end) {
+        PIM_TRACE_SCOPE("transpose");
+        uint64_t cache_line[8];
+        const uint32_t buffer_prefetch =
+            transfer_parameters.buffer_prefetch_words;
+
+        MRAMAddressIterator it(symbol_offset + (word_begin * 8), dpu_id);
+        for (uint32_t i = word_begin; i < word_end; ++i, ++it) {
+            if ((i % 8 == 0) && (i + buffer_prefetch < word_end)) {
+                source.Prefetch(dpu_id, i + buffer_prefetch);
+            }
+            uint64_t offset = *it;
+
+            source.Load(dpu_id, i, cache_line);
+            byte_interleave_avx512(cache_line,
+                                   (uint64_t *)(ptr_dest + offset), STREAM);
+
+            source.Load(dpu_id + 4, i, cache_line);
+            byte_interleave_avx512(cache_line,
+                                   (uint64_t *)(ptr_dest + offset + 0x40),
+                                   STREAM);
+            if (!STREAM) {
                 __builtin_ia32_clflushopt((void *)(ptr_dest + offset));
+                __builtin_ia32_clflushopt((void *)(ptr_dest + offset + 0x40));
             }
         }
-        __builtin_ia32_mfence();
+    }
+
+    // Words [word_begin, word_end) of the 16 DPUs in group dpu_id. The final
+    // mfence drains this task's stores before it returns.
+    template <typename Source>
+    void SendToRankMRAM(Source &source, uint32_t symbol_offset,
+                        uint8_t *ptr_dest, uint32_t dpu_id,
+                        uint32_t word_begin, uint32_t word_end,
+                        bool fence = true) {
+        if (transfer_parameters.streaming_send) {
+            SendToRankMRAMKernel<true>(source, symbol_offset, ptr_dest, dpu_id,
+                                       word_begin, word_end);
+        } else {
+            SendToRankMRAMKernel<false>(source, symbol_offset, ptr_dest,
+                                        dpu_id, word_begin, word_end);
+        }
+        if (fence) {
+            __builtin_ia32_mfence();
+        }
     }
 
     void SendToRankMRAM(uint8_t **buffers, uint32_t symbol_offset,
-                        uint8_t *ptr_dest, uint32_t length) {
-        assert(aligned(symbol_offset, sizeof(uint64_t)));
-        assert(aligned(length, sizeof(uint64_t)));
-        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
+                        uint8_t *ptr_dest, uint32_t dpu_id,
+                        uint32_t word_begin, uint32_t word_end,
+                        bool fence = true) {
+        BufferSource source{buffers};
+        SendToRankMRAM(source, symbol_offset, ptr_dest, dpu_id, word_begin,
+                       word_end, fence);
+    }
 
-        uint64_t cache_line[8];
+    // Word count of every (rank, slot) for ragged transfers, and the longest
+    // DPU of each (rank, dpu_id group). Returns the longest DPU overall.
+    uint32_t GetRaggedWordCounts(const uint64_t *lengths,
+                                 std::vector<uint32_t> &nr_of_words,
+                                 std::vector<uint32_t> &max_nr_of_words) {
+        nr_of_words.assign(nr_of_ranks * MAX_NR_DPUS_PER_RANK, 0);
+        max_nr_of_words.assign(nr_of_ranks * 4, 0);
+        uint32_t nr_of_words_all = 0;
+        for (uint32_t i = 0, dpu = 0; i < nr_of_ranks; i++) {
+            for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+                if (!ranks[i]->dpus[j].enabled) {
+                    continue;
+                }
+                uint32_t words = (lengths[dpu++] + sizeof(uint64_t) - 1) /
+                                 sizeof(uint64_t);
+                nr_of_words[i * MAX_NR_DPUS_PER_RANK + j] = words;
+                uint32_t &group_max = max_nr_of_words[i * 4 + j % 4];
+                group_max = std::max(group_max, words);
+                nr_of_words_all = std::max(nr_of_words_all, words);
+            }
+        }
+        return nr_of_words_all;
+    }
+
+    // Anonymous memory preferably placed on NUMA node `node`; the placement
+    // is best effort.
+    uint8_t *AllocateOnNUMANode(size_t size, int node) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(ptr != MAP_FAILED);
+        if (node >= 0 && node < 64) {
+            const int MPOL_PREFERRED_MODE = 1;
+            unsigned long node_mask = 1UL << node;
+            syscall(SYS_mbind, ptr, size, MPOL_PREFERRED_MODE, &node_mask,
+                    sizeof(node_mask) * 8, 0);
+        }
+        return (uint8_t *)ptr;
+    }
 
+    // Source of DPU slot j of rank_id for the small-transfer kernels. A fully
+    // enabled rank maps slots to consecutive DPU IDs without checks.
+    template <bool FULL_RANK>
+    inline uint64_t *GetSmallTransferBuffer(uint8_t **buffers,
+                                            uint32_t buffer_offset,
+                                            size_t rank_id, uint32_t j) {
+        if (FULL_RANK) {
+            return (uint64_t *)(buffers[firstDPUIDOfRank[rank_id] + j] +
+                                buffer_offset);
+        }
+        int32_t dpu = dpuIDOfSlot[rank_id * MAX_NR_DPUS_PER_RANK + j];
+        return dpu < 0 ? nullptr
+                       : (uint64_t *)(buffers[dpu] + buffer_offset);
+    }
+
+    // All 64 slots of a rank, NR_WORDS words each, in one task. Lengths are
+    // compile-time constants so the loops unroll; no source prefetching.
+    // Stores follow streaming_send like SendToRankMRAM's.
+    template <uint32_t NR_WORDS, bool FULL_RANK>
+    void SendToRankMRAMSmall(uint8_t **buffers, uint32_t buffer_offset,
+                             uint32_t symbol_offset, size_t rank_id) {
+        uint8_t *ptr_dest = base_addrs[rank_id];
+        const bool stream = transfer_parameters.streaming_send;
+        uint64_t *sources[MAX_NR_DPUS_PER_RANK];
+        for (uint32_t j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+            sources[j] = GetSmallTransferBuffer<FULL_RANK>(
+                buffers, buffer_offset, rank_id, j);
+        }
+        uint64_t cache_line[8] = {0};
         for (uint32_t dpu_id = 0; dpu_id < 4; ++dpu_id) {
-            for (uint32_t i = 0; i < length / sizeof(uint64_t); ++i) {
-                if ((i % 8 == 0) && (i + 8 < length / sizeof(uint64_t))) {
-                    for (int j = 0; j < 16; j++) {
-                        __builtin_prefetch(
-                            ((uint64_t *)buffers[j * 4 + dpu_id]) + i + 8);
+            MRAMAddressIterator it(symbol_offset, dpu_id);
+            for (uint32_t i = 0; i < NR_WORDS; ++i, ++it) {
+                for (uint32_t half = 0; half < 2; half++) {
+                    for (int j = 0; j < 8; j++) {
+                        uint64_t *source = sources[j * 8 + dpu_id + half * 4];
+                        if (FULL_RANK || source != nullptr) {
+                            cache_line[j] = source[i];
+                        }
+                    }
+                    uint8_t *line = ptr_dest + *it + half * 0x40;
+                    byte_interleave_avx512(cache_line, (uint64_t *)line,
+                                           stream);
+                    if (!stream) {
+                        __builtin_ia32_clflushopt((void *)line);
                     }
                 }
-                uint64_t offset =
-                    GetCorrectOffsetMRAM(symbol_offset + (i * 8), dpu_id);
+            }
+        }
+        __builtin_ia32_mfence();
+    }
 
-                for (int j = 0; j < 8; j++) {
-                    if (buffers[j * 8 + dpu_id] == nullptr) {
-                        continue;
-                    }
-                    cache_line[j] =
-                        *(((uint64_t *)buffers[j * 8 + dpu_id]) + i);
+    template <uint32_t NR_WORDS, bool FULL_RANK>
+    void ReceiveFromRankMRAMSmall(uint8_t **buffers, uint32_t buffer_offset,
+                                  uint32_t symbol_offset, size_t rank_id) {
+        uint8_t *ptr_dest = base_addrs[rank_id];
+        auto Flush = [&]() {
+            for (uint32_t dpu_id = 0; dpu_id < 4; ++dpu_id) {
+                MRAMAddressIterator it(symbol_offset, dpu_id);
+                for (uint32_t i = 0; i < NR_WORDS; ++i, ++it) {
+                    __builtin_ia32_clflushopt((void *)(ptr_dest + *it));
+                    __builtin_ia32_clflushopt((void *)(ptr_dest + *it + 0x40));
                 }
-                byte_interleave_avx512(cache_line,
-                                       (uint64_t *)(ptr_dest + offset), true);
+            }
+            __builtin_ia32_mfence();
+        };
 
-                offset += 0x40;
-                for (int j = 0; j < 8; j++) {
-                    if (buffers[j * 8 + dpu_id + 4] == nullptr) {
-                        continue;
+        Flush();
+        uint64_t *targets[MAX_NR_DPUS_PER_RANK];
+        for (uint32_t j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+            targets[j] = GetSmallTransferBuffer<FULL_RANK>(
+                buffers, buffer_offset, rank_id, j);
+        }
+        uint64_t cache_line[8], cache_line_interleave[8];
+        for (uint32_t dpu_id = 0; dpu_id < 4; ++dpu_id) {
+            MRAMAddressIterator it(symbol_offset, dpu_id);
+            for (uint32_t i = 0; i < NR_WORDS; ++i, ++it) {
+                for (uint32_t half = 0; half < 2; half++) {
+                    volatile uint64_t *line =
+                        (volatile uint64_t *)(ptr_dest + *it + half * 0x40);
+                    for (int j = 0; j < 8; j++) {
+                        cache_line[j] = line[j];
+                    }
+                    byte_interleave_avx512(cache_line, cache_line_interleave,
+                                           false);
+                    for (int j = 0; j < 8; j++) {
+                        uint64_t *target = targets[j * 8 + dpu_id + half * 4];
+                        if (FULL_RANK || target != nullptr) {
+                            target[i] = cache_line_interleave[j];
+                        }
                     }
-                    cache_line[j] =
-                        *(((uint64_t *)buffers[j * 8 + dpu_id + 4]) + i);
                 }
-                byte_interleave_avx512(cache_line,
-                                       (uint64_t *)(ptr_dest + offset), true);
             }
         }
+        Flush();
+    }
+
+    typedef void (DirectPIMInterface::*SmallTransferKernel)(uint8_t **,
+                                                            uint32_t,
+                                                            uint32_t, size_t);
+
+    // Kernels for 1..MAX_SMALL_TRANSFER_WORDS words, indexed by words - 1.
+    template <bool SEND, bool FULL_RANK, size_t... I>
+    static const SmallTransferKernel *GetSmallTransferKernels(
+        std::index_sequence<I...>) {
+        static const SmallTransferKernel kernels[] = {
+            (SEND ? &DirectPIMInterface::SendToRankMRAMSmall<I + 1, FULL_RANK>
+                  : &DirectPIMInterface::ReceiveFromRankMRAMSmall<I + 1,
+                                                                  FULL_RANK>)...};
+        return kernels;
+    }
+
+    template <bool SEND>
+    void SmallTransfer(uint8_t **buffers, uint32_t buffer_offset,
+                       uint32_t mram_address, uint32_t length) {
+        assert(aligned(mram_address, sizeof(uint64_t)));
+        assert(aligned(length, sizeof(uint64_t)));
+        assert(length > 0 && length <= MAX_SMALL_TRANSFER_SIZE);
+        assert((uint64_t)mram_address + length <= MRAM_SIZE);
+        auto seq = std::make_index_sequence<MAX_SMALL_TRANSFER_WORDS>();
+        const SmallTransferKernel *full_kernels =
+            GetSmallTransferKernels<SEND, true>(seq);
+        const SmallTransferKernel *partial_kernels =
+            GetSmallTransferKernels<SEND, false>(seq);
+        uint32_t k = length / sizeof(uint64_t) - 1;
+        auto TransferIthRank = [&](size_t i) {
+            PIM_TRACE_SCOPE("small transfer", i);
+            SwitchMuxToHost(i);
+            SmallTransferKernel kernel =
+                rankFullyEnabled[i] ? full_kernels[k] : partial_kernels[k];
+            (this->*kernel)(buffers, buffer_offset, mram_address, i);
+        };
+        if (nr_of_ranks == 1) {
+            TransferIthRank(0);
+            return;
+        }
+        ParallelFor(0, nr_of_ranks, TransferIthRank);
+    }
 
-        __builtin_ia32_mfence();
+    // Number of word ranges each dpu_id group of a rank is cut into.
+    uint32_t GetNrOfChunksPerGroup(uint32_t nr_of_words) {
+        uint32_t nr_of_chunks = (nr_of_tasks_per_rank + 3) / 4;
+        uint32_t max_nr_of_chunks =
+            (nr_of_words + MIN_WORDS_PER_TASK - 1) / MIN_WORDS_PER_TASK;
+        nr_of_chunks = std::min(nr_of_chunks, max_nr_of_chunks);
+        return std::max(nr_of_chunks, (uint32_t)1);
+    }
+
+    // Hand the MRAM of a rank to the host.
+    void SwitchMuxToHost(size_t rank_id) {
+        PIM_TRACE_SCOPE("mux switch", rank_id);
+        DPU_ASSERT(dpu_switch_mux_for_rank(ranks[rank_id], true));
+    }
+
+    // Switch every rank to the host, then run f(rank_id, dpu_id, word_begin,
+    // word_end) over all (rank, dpu_id group, word range) tasks in parallel.
+    template <typename F>
+    void ForEachRankTask(uint32_t nr_of_words, F f) {
+        ParallelFor(
+            0, nr_of_ranks,
+            [&](size_t i) { SwitchMuxToHost(i); });
+        ForEachTaskOfRanks(0, nr_of_ranks, nr_of_words, f);
+    }
+
+    // ForEachRankTask on ranks [rank_begin, rank_end) whose mux is already
+    // switched to the host.
+    template <typename F>
+    void ForEachTaskOfRanks(size_t rank_begin, size_t rank_end,
+                            uint32_t nr_of_words, F f) {
+        uint32_t nr_of_chunks = GetNrOfChunksPerGroup(nr_of_words);
+        uint32_t chunk_words = (nr_of_words + nr_of_chunks - 1) / nr_of_chunks;
+        chunk_words = (chunk_words + 7) / 8 * 8;  // keep prefetch alignment
+        uint32_t nr_of_tasks_per_rank = 4 * nr_of_chunks;
+
+        ParallelFor(
+            0, (rank_end - rank_begin) * nr_of_tasks_per_rank,
+            [&](size_t t) {
+                size_t rank_id = rank_begin + t / nr_of_tasks_per_rank;
+                uint32_t dpu_id = (t / nr_of_chunks) % 4;
+                uint32_t word_begin = (t % nr_of_chunks) * chunk_words;
+                uint32_t word_end =
+                    std::min(nr_of_words, word_begin + chunk_words);
+                if (word_begin < word_end) {
+                    PIM_TRACE_SCOPE("task", rank_id);
+                    f(rank_id, dpu_id, word_begin, word_end);
+                }
+            });
+    }
+
+    // A batch command with its MRAM address and per-slot buffers resolved.
+    struct ResolvedTransfer {
+        bool send;
+        uint32_t mram_offset;
+        uint32_t nr_of_words;
+        std::vector<uint8_t *> buffers_aligned;
+    };
+
+    std::vector<ResolvedTransfer> ResolveBatch(
+        const std::vector<PIMTransferCommand> &commands) {
+        std::vector<ResolvedTransfer> transfers(commands.size());
+        for (size_t k = 0; k < commands.size(); k++) {
+            const PIMTransferCommand &command = commands[k];
+            ResolvedTransfer &transfer = transfers[k];
+            transfer.send = command.send;
+            transfer.mram_offset = GetMRAMSymbolAddress(command.symbol_name) +
+                                   command.symbol_offset;
+            transfer.nr_of_words = command.length / sizeof(uint64_t);
+            assert(aligned(transfer.mram_offset, sizeof(uint64_t)));
+            assert(aligned(command.length, sizeof(uint64_t)));
+            assert((uint64_t)transfer.mram_offset + command.length <=
+                   MRAM_SIZE);
+            transfer.buffers_aligned.resize(nr_of_ranks *
+                                            MAX_NR_DPUS_PER_RANK);
+            AlignBuffers(command.buffers, command.buffer_offset,
+                         transfer.buffers_aligned.data());
+        }
+        return transfers;
+    }
+
+    // All transfers of a batch on one rank, in order, after a single mux
+    // switch. Consecutive transfers of one direction share their fences:
+    // one after all sends, one after all pre-load flushes and one after all
+    // post-load flushes of the receives.
+    void ExecuteBatchOnRank(size_t rank_id,
+                            const std::vector<ResolvedTransfer> &transfers) {
+        PIM_TRACE_SCOPE("batch", rank_id);
+        SwitchMuxToHost(rank_id);
+        auto Buffers = [&](const ResolvedTransfer &transfer) {
+            return (uint8_t **)&transfer
+                .buffers_aligned[rank_id * MAX_NR_DPUS_PER_RANK];
+        };
+        for (size_t begin = 0, end = 0; begin < transfers.size();
+             begin = end) {
+            while (end < transfers.size() &&
+                   transfers[end].send == transfers[begin].send) {
+                end++;
+            }
+            if (transfers[begin].send) {
+                for (size_t k = begin; k < end; k++) {
+                    for (uint32_t dpu_id = 0; dpu_id < 4; dpu_id++) {
+                        SendToRankMRAM(Buffers(transfers[k]),
+                                       transfers[k].mram_offset,
+                                       base_addrs[rank_id], dpu_id, 0,
+                                       transfers[k].nr_of_words, false);
+                    }
+                }
+                __builtin_ia32_mfence();
+                continue;
+            }
+            auto FlushAll = [&]() {
+                for (size_t k = begin; k < end; k++) {
+                    for (uint32_t dpu_id = 0; dpu_id < 4; dpu_id++) {
+                        FlushRankMRAM(transfers[k].mram_offset,
+                                      base_addrs[rank_id], dpu_id, 0,
+                                      transfers[k].nr_of_words, false);
+                    }
+                }
+                __builtin_ia32_mfence();
+            };
+            FlushAll();
+            for (size_t k = begin; k < end; k++) {
+                for (uint32_t dpu_id = 0; dpu_id < 4; dpu_id++) {
+                    BufferSink sink{Buffers(transfers[k])};
+                    ReceiveFromRankMRAMKernel(sink, transfers[k].mram_offset,
+                                              base_addrs[rank_id], dpu_id, 0,
+                                              transfers[k].nr_of_words);
+                }
+            }
+            FlushAll();
+        }
     }
 
     bool DirectAvailable(bool async_transfer) {
@@ -302,9 +956,15 @@ class DirectPIMInterface : public PIMInterface {
     }
 
     // Find symbol address offset
-    uint32_t GetSymbolOffset(std::string symbol_name) {
+    // Lookups are cached until the program changes.
+    uint32_t GetSymbolOffset(const std::string &symbol_name) {
+        auto it = offset_list.find(symbol_name);
+        if (it != offset_list.end()) {
+            return it->second;
+        }
         dpu_symbol_t symbol;
         DPU_ASSERT(dpu_get_symbol(program, symbol_name.c_str(), &symbol));
+        offset_list.emplace(symbol_name, symbol.address);
         return symbol.address;
     }
 
@@ -370,6 +1030,152 @@ class DirectPIMInterface : public PIMInterface {
         exit(0);
     }
 
+    // A contiguous WRAM word range covering one or more batch items, and
+    // where it lives in the per-CI scratch buffer.
+    struct WRAMReadRange {
+        uint32_t wram_word_offset, nb_of_words, scratch_word_offset;
+    };
+
+    // Items sorted by WRAM address and merged into ranges. Gaps up to
+    // MAX_WRAM_GAP_WORDS are read too: a longer read is cheaper than another
+    // UFI command.
+    std::vector<WRAMReadRange> MergeWRAMReadItems(
+        const std::vector<PIMReadItem> &items,
+        std::vector<uint32_t> &scratch_offset_of_item) {
+        const uint32_t MAX_WRAM_GAP_WORDS = 16;
+        std::vector<uint32_t> order(items.size());
+        std::vector<uint32_t> &word_offset_of_item = scratch_offset_of_item;
+        word_offset_of_item.resize(items.size());
+        for (size_t k = 0; k < items.size(); k++) {
+            uint32_t symbol_base_offset = GetSymbolOffset(items[k].symbol_name);
+            assert(!(symbol_base_offset & MRAM_ADDRESS_SPACE));
+            uint32_t address = symbol_base_offset + items[k].symbol_offset;
+            assert(aligned(address, sizeof(dpuword_t)));
+            assert(aligned(items[k].length, sizeof(dpuword_t)));
+            word_offset_of_item[k] = address >> 2;
+            order[k] = k;
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return word_offset_of_item[a] < word_offset_of_item[b];
+        });
+
+        std::vector<WRAMReadRange> ranges;
+        uint32_t scratch_words = 0;
+        for (uint32_t k : order) {
+            uint32_t begin = word_offset_of_item[k];
+            uint32_t end = begin + items[k].length / sizeof(dpuword_t);
+            if (begin == end) {
+                continue;
+            }
+            if (!ranges.empty()) {
+                WRAMReadRange &last = ranges.back();
+                uint32_t last_end = last.wram_word_offset + last.nb_of_words;
+                if (begin <= last_end + MAX_WRAM_GAP_WORDS) {
+                    if (end > last_end) {
+                        scratch_words += end - last_end;
+                        last.nb_of_words = end - last.wram_word_offset;
+                    }
+                    continue;
+                }
+            }
+            ranges.push_back({begin, end - begin, scratch_words});
+            scratch_words += end - begin;
+        }
+
+        // Items are re-addressed relative to the scratch buffer.
+        for (uint32_t &word : word_offset_of_item) {
+            auto range = std::upper_bound(
+                ranges.begin(), ranges.end(), word,
+                [](uint32_t w, const WRAMReadRange &r) {
+                    return w < r.wram_word_offset;
+                });
+            if (range != ranges.begin()) {
+                --range;
+                word = range->scratch_word_offset +
+                       (word - range->wram_word_offset);
+            }
+        }
+        return ranges;
+    }
+
+    // One ufi_select_dpu per DPU slot, then one ufi_wram_read per merged
+    // range; items are copied out of the scratch buffer afterwards.
+    void ReceiveFromRankWRAMBatch(size_t rank_id,
+                                  const std::vector<PIMReadItem> &items,
+                                  const std::vector<uint32_t> &scratch_offset_of_item,
+                                  const std::vector<WRAMReadRange> &ranges) {
+        if (ranges.empty()) {
+            return;
+        }
+        dpu_rank_t *rank = ranks[rank_id];
+        const WRAMReadRange &last = ranges.back();
+        assert(last.wram_word_offset + last.nb_of_words <=
+               rank->description->hw.memories.wram_size);
+
+        uint8_t nr_cis =
+            rank->description->hw.topology.nr_of_control_interfaces;
+        uint8_t nr_dpus_per_ci =
+            rank->description->hw.topology.nr_of_dpus_per_control_interface;
+        uint32_t scratch_words = last.scratch_word_offset + last.nb_of_words;
+        std::vector<dpuword_t> scratch((size_t)nr_cis * scratch_words);
+        size_t dpu_ids[MAX_NR_DPUS_PER_RANK];
+        dpu_error_t status;
+
+        {
+            size_t dpu_id = firstDPUIDOfRank[rank_id];
+            for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+                dpu_ids[j] = rank->dpus[j].enabled ? dpu_id++ : nr_of_dpus;
+            }
+        }
+
+        for (dpu_member_id_t each_dpu = 0; each_dpu < nr_dpus_per_ci;
+             ++each_dpu) {
+            dpuword_t *wram_array[DPU_MAX_NR_CIS] = {0};
+            uint8_t mask = 0;
+
+            for (dpu_slice_id_t each_ci = 0; each_ci < nr_cis; ++each_ci) {
+                if (dpu_ids[get_transfer_matrix_index(rank, each_dpu,
+                                                      each_ci)] < nr_of_dpus) {
+                    mask |= CI_MASK_ONE(each_ci);
+                }
+            }
+            if (mask == 0) {
+                continue;
+            }
+
+            FF((dpu_error_t)ufi_select_dpu(rank, &mask, each_dpu));
+            for (const WRAMReadRange &range : ranges) {
+                for (dpu_slice_id_t each_ci = 0; each_ci < nr_cis; ++each_ci) {
+                    wram_array[each_ci] =
+                        &scratch[(size_t)each_ci * scratch_words +
+                                 range.scratch_word_offset];
+                }
+                FF((dpu_error_t)ufi_wram_read(rank, mask, wram_array,
+                                              range.wram_word_offset,
+                                              range.nb_of_words));
+            }
+
+            for (dpu_slice_id_t each_ci = 0; each_ci < nr_cis; ++each_ci) {
+                size_t dpu_id =
+                    dpu_ids[get_transfer_matrix_index(rank, each_dpu, each_ci)];
+                if (dpu_id >= nr_of_dpus) {
+                    continue;
+                }
+                const dpuword_t *ci_scratch =
+                    &scratch[(size_t)each_ci * scratch_words];
+                for (size_t k = 0; k < items.size(); k++) {
+                    memcpy(items[k].buffers[dpu_id] + items[k].buffer_offset,
+                           ci_scratch + scratch_offset_of_item[k],
+                           items[k].length);
+                }
+            }
+        }
+        return;
+    end:
+        std::cout << "ReceiveFromRankWRAMBatch ERROR" << std::endl;
+        exit(0);
+    }
+
    public:
     DirectPIMInterface(dpu_set_t dpu_set) : PIMInterface(dpu_set) {
         load_from_dpu_set(this->dpu_set);
@@ -380,11 +1186,131 @@ class DirectPIMInterface : public PIMInterface {
         load_from_dpu_set(this->dpu_set);
     }
 
+    // Load a binary through the SDK on all ranks; it becomes the program used
+    // to resolve symbols.
+    dpu_program_t *LoadProgram(std::string binary) {
+        dpu_program_t *new_program;
+        DPU_ASSERT(dpu_load(dpu_set, binary.c_str(), &new_program));
+        program = new_program;
+        offset_list.clear();
+        return new_program;
+    }
+
+    // Point the DPUs of ranks [rank_begin, rank_end) at an already loaded
+    // program, for the SDK's symbol resolution and logs. Symbols of the
+    // interface follow only when all ranks run the same program. Every DPU
+    // holds a reference on its program, as after dpu_load, so the next
+    // dpu_load or dpu_free releases the right one.
+    void SetProgramOfRanks(dpu_program_t *new_program, size_t rank_begin,
+                           size_t rank_end) {
+        for (size_t i = rank_begin; i < rank_end; i++) {
+            for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+                dpu_t &dpu = ranks[i]->dpus[j];
+                if (dpu.enabled && dpu.program != new_program) {
+                    dpu_take_program_ref(new_program);
+                    if (dpu.program != nullptr) {
+                        dpu_free_program(dpu.program);
+                    }
+                    dpu.program = new_program;
+                }
+            }
+        }
+        if (rank_begin == 0 && rank_end == nr_of_ranks) {
+            program = new_program;
+            offset_list.clear();
+        }
+    }
+
+    // Read the image of the first enabled DPU of rank 0.
+    PIMProgramImage ReadProgramImage() {
+        PIMProgramImage image;
+        dpu_rank_t *rank = ranks[0];
+        uint32_t iram_size = rank->description->hw.memories.iram_size;
+        uint32_t wram_size = rank->description->hw.memories.wram_size;
+        image.iram.resize(iram_size);
+        image.wram.resize(wram_size);
+        dpuinstruction_t *iram_array[DPU_MAX_NR_CIS] = {0};
+        dpuword_t *wram_array[DPU_MAX_NR_CIS] = {0};
+        dpu_error_t status;
+        int j = 0;
+        uint8_t mask;
+
+        while (!rank->dpus[j].enabled) {
+            j++;
+        }
+        iram_array[rank->dpus[j].slice_id] = image.iram.data();
+        wram_array[rank->dpus[j].slice_id] = image.wram.data();
+        mask = CI_MASK_ONE(rank->dpus[j].slice_id);
+        FF((dpu_error_t)ufi_select_dpu(rank, &mask, rank->dpus[j].dpu_id));
+        FF((dpu_error_t)ufi_iram_read(rank, mask, iram_array, 0, iram_size));
+        FF((dpu_error_t)ufi_wram_read(rank, mask, wram_array, 0, wram_size));
+
+        while (!image.iram.empty() && image.iram.back() == 0) {
+            image.iram.pop_back();
+        }
+        while (!image.wram.empty() && image.wram.back() == 0) {
+            image.wram.pop_back();
+        }
+        return image;
+    end:
+        std::cout << "ReadProgramImage ERROR" << std::endl;
+        exit(0);
+    }
+
+    // Broadcast an image to all DPUs of a rank. All of WRAM past the image
+    // is cleared: whatever the previous program wrote at run time (stacks,
+    // .bss, heap) must not leak into zero-initialized globals.
+    void WriteRankProgramImage(size_t rank_id, const PIMProgramImage &image) {
+        dpu_rank_t *rank = ranks[rank_id];
+        uint8_t nr_cis =
+            rank->description->hw.topology.nr_of_control_interfaces;
+        std::vector<dpuword_t> wram(image.wram);
+        wram.resize(rank->description->hw.memories.wram_size, 0);
+        dpuinstruction_t *iram_array[DPU_MAX_NR_CIS] = {0};
+        dpuword_t *wram_array[DPU_MAX_NR_CIS] = {0};
+        dpu_error_t status;
+        uint8_t mask = (uint8_t)((1u << nr_cis) - 1);
+
+        for (dpu_slice_id_t each_ci = 0; each_ci < nr_cis; ++each_ci) {
+            iram_array[each_ci] = (dpuinstruction_t *)image.iram.data();
+            wram_array[each_ci] = wram.data();
+        }
+        FF((dpu_error_t)ufi_select_all(rank, &mask));
+        if (!image.iram.empty()) {
+            FF((dpu_error_t)ufi_iram_write(rank, mask, iram_array, 0,
+                                           image.iram.size()));
+        }
+        if (!wram.empty()) {
+            FF((dpu_error_t)ufi_wram_write(rank, mask, wram_array, 0,
+                                           wram.size()));
+        }
+        return;
+    end:
+        std::cout << "WriteRankProgramImage ERROR" << std::endl;
+        exit(0);
+    }
+
+    // An independent interface over ranks [rank_begin, rank_end), with its
+    // own program, launches, symbol cache and a pool of nr_of_threads
+    // transfer threads, started here and kept until it is deleted. Groups
+    // over disjoint ranks can be used concurrently from different threads
+    // without locking. This interface must outlive them.
+    DirectPIMInterface *CreateRankGroup(uint32_t rank_begin, uint32_t rank_end,
+                                        uint32_t nr_of_threads) {
+        assert(nr_of_threads > 0);
+        DirectPIMInterface *group =
+            new DirectPIMInterface(GetRankSubset(rank_begin, rank_end));
+        group->do_not_free_dpu_set_when_delete();
+        group->SetNrOfPrivateThreads(nr_of_threads);
+        group->SetNrOfTasksPerRank(
+            std::max((uint32_t)4, nr_of_threads / (rank_end - rank_begin)));
+        return group;
+    }
+
     // not modifying Launch currently because the default "error handling" seems
     // to be useful.
     void Launch(bool async) {
-        auto async_parameter = async ? DPU_ASYNCHRONOUS : DPU_SYNCHRONOUS;
-        DPU_ASSERT(dpu_launch(dpu_set, async_parameter));
+        LaunchDPUs(async);
     }
 
     void ReceiveFromWRAM(uint8_t **buffers, uint32_t symbol_base_offset,
@@ -402,13 +1328,27 @@ class DirectPIMInterface : public PIMInterface {
         //     ReceiveFromRankWRAM(&buffers[i * MAX_NR_DPUS_PER_RANK],
         //                         wram_word_offset, nb_of_words, ranks[i]);
         // }
-        parlay::parallel_for(
+        ParallelFor(
             0, nr_of_ranks,
             [&](size_t i) {
                 ReceiveFromRankWRAM(&buffers[i * MAX_NR_DPUS_PER_RANK],
                                     wram_word_offset, nb_of_words, ranks[i]);
-            },
-            1, false);
+            });
+    }
+
+    // All items must be WRAM symbols. Each DPU is selected once per rank and
+    // read with one UFI command per merged address range.
+    void ReceiveFromPIMBatch(const std::vector<PIMReadItem> &items) {
+        assert(DirectAvailable(false));
+        std::vector<uint32_t> scratch_offset_of_item;
+        std::vector<WRAMReadRange> ranges =
+            MergeWRAMReadItems(items, scratch_offset_of_item);
+        ParallelFor(
+            0, nr_of_ranks,
+            [&](size_t i) {
+                ReceiveFromRankWRAMBatch(i, items, scratch_offset_of_item,
+                                         ranges);
+            });
     }
 
     void ReceiveFromMRAM(uint8_t **buffers, uint32_t symbol_base_offset,
@@ -417,21 +1357,186 @@ class DirectPIMInterface : public PIMInterface {
         assert(DirectAvailable(async_transfer));
         assert(symbol_base_offset & MRAM_ADDRESS_SPACE);
         symbol_offset += symbol_base_offset ^ MRAM_ADDRESS_SPACE;
-        auto ReceiveFromIthRank = [&](size_t i) {
-            DPU_ASSERT(dpu_switch_mux_for_rank(ranks[i], true));
-            ReceiveFromRankMRAM(&buffers[i * MAX_NR_DPUS_PER_RANK],
-                                symbol_offset, base_addrs[i], length);
-        };
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert(aligned(length, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
 
-        parlay::parallel_for(
-            0, nr_of_ranks,
-            [&](size_t i) {
-                ReceiveFromIthRank(i);
-            },
-            1, false);
-        // for (size_t i = 0; i < nr_of_ranks; i++) {
-        //     ReceiveFromIthRank(i);
-        // }
+        ForEachRankTask(length / sizeof(uint64_t),
+                        [&](size_t i, uint32_t dpu_id, uint32_t word_begin,
+                            uint32_t word_end) {
+                            ReceiveFromRankMRAM(
+                                &buffers[i * MAX_NR_DPUS_PER_RANK],
+                                symbol_offset, base_addrs[i], dpu_id,
+                                word_begin, word_end);
+                        });
+    }
+
+    // Receive `length` bytes of MRAM from every DPU, folding them element-wise
+    // instead of storing them: result[e] = op over all DPUs of element e.
+    // Each (rank, dpu_id group) keeps one partial, combined at the end.
+    template <typename T, typename Op>
+    void ReceiveFromPIMReduce(T *result, std::string symbol_name,
+                              uint32_t symbol_offset, uint32_t length, Op op,
+                              T identity) {
+        static_assert(sizeof(uint64_t) % sizeof(T) == 0,
+                      "elements must tile a 64-bit word");
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "elements are copied bytewise");
+        assert(DirectAvailable(false));
+
+        uint32_t symbol_base_offset = GetSymbolOffset(symbol_name);
+        assert(symbol_base_offset & MRAM_ADDRESS_SPACE);
+        symbol_offset += symbol_base_offset ^ MRAM_ADDRESS_SPACE;
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert(aligned(length, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
+
+        const size_t K = sizeof(uint64_t) / sizeof(T);
+        size_t nr_of_elements = length / sizeof(T);
+        size_t nr_of_partials = (size_t)nr_of_ranks * 4;
+        std::unique_ptr<T[]> partials(new T[nr_of_partials * nr_of_elements]);
+
+        ForEachRankTask(
+            length / sizeof(uint64_t),
+            [&](size_t i, uint32_t dpu_id, uint32_t word_begin,
+                uint32_t word_end) {
+                T *partial = &partials[(i * 4 + dpu_id) * nr_of_elements];
+                std::fill(partial + word_begin * K, partial + word_end * K,
+                          identity);
+                ReduceSink<T, Op> sink{partial, GetEnabledMaskOfRank(i), op};
+                ReceiveFromRankMRAM(sink, symbol_offset, base_addrs[i], dpu_id,
+                                    word_begin, word_end);
+            });
+
+        const size_t BLOCK = 1 << 12;
+        ParallelFor(0, (nr_of_elements + BLOCK - 1) / BLOCK, [&](size_t b) {
+            size_t end = std::min(nr_of_elements, (b + 1) * BLOCK);
+            for (size_t e = b * BLOCK; e < end; e++) {
+                T value = identity;
+                for (size_t p = 0; p < nr_of_partials; p++) {
+                    value = op(value, partials[p * nr_of_elements + e]);
+                }
+                result[e] = value;
+            }
+        });
+    }
+
+    template <typename T, typename Op>
+    void ReceiveFromPIMReduce(T *result, std::string symbol_name,
+                              uint32_t symbol_offset, uint32_t length, Op op) {
+        ReceiveFromPIMReduce(result, symbol_name, symbol_offset, length, op,
+                             Op::Identity());
+    }
+
+    // Two-phase collection of data-dependent output. Phase one reads a
+    // uint64_t byte count per DPU from `size_symbol_name + size_offset` (WRAM
+    // or MRAM heap). Phase two reads only those bytes, at most `max_length`,
+    // from `symbol_name + symbol_offset`; each (rank, dpu_id group) stops at
+    // its longest DPU. A size above `max_length` is clamped to it, so the
+    // result never holds more than `max_length` bytes of a DPU.
+    PIMRaggedResult ReceiveRaggedFromPIM(std::string size_symbol_name,
+                                         uint32_t size_offset,
+                                         std::string symbol_name,
+                                         uint32_t symbol_offset,
+                                         uint32_t max_length) {
+        assert(DirectAvailable(false));
+        PIMRaggedResult result;
+        result.sizes.resize(nr_of_dpus);
+        {
+            std::vector<uint8_t *> size_buffers(nr_of_dpus);
+            for (uint32_t i = 0; i < nr_of_dpus; i++) {
+                size_buffers[i] = (uint8_t *)&result.sizes[i];
+            }
+            ReceiveFromPIM(size_buffers.data(), 0, size_symbol_name,
+                           size_offset, sizeof(uint64_t), false);
+        }
+
+        result.offsets.resize(nr_of_dpus + 1);
+        result.offsets[0] = 0;
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            result.sizes[i] = std::min(result.sizes[i], (uint64_t)max_length);
+            uint64_t padded_size = (result.sizes[i] + sizeof(uint64_t) - 1) /
+                                   sizeof(uint64_t) * sizeof(uint64_t);
+            result.offsets[i + 1] = result.offsets[i] + padded_size;
+        }
+        result.data.reset(new uint8_t[result.offsets[nr_of_dpus]]);
+
+        uint32_t symbol_base_offset = GetSymbolOffset(symbol_name);
+        assert(symbol_base_offset & MRAM_ADDRESS_SPACE);
+        symbol_offset += symbol_base_offset ^ MRAM_ADDRESS_SPACE;
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + max_length <= MRAM_SIZE);
+
+        std::vector<uint8_t *> buffers(nr_of_dpus);
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            buffers[i] = result.data.get() + result.offsets[i];
+        }
+        std::vector<uint8_t *> buffers_aligned(nr_of_ranks *
+                                               MAX_NR_DPUS_PER_RANK);
+        AlignBuffers(buffers.data(), 0, buffers_aligned.data());
+
+        std::vector<uint32_t> nr_of_words, max_nr_of_words;
+        uint32_t nr_of_words_all = GetRaggedWordCounts(
+            result.sizes.data(), nr_of_words, max_nr_of_words);
+
+        ForEachRankTask(
+            nr_of_words_all, [&](size_t i, uint32_t dpu_id,
+                                 uint32_t word_begin, uint32_t word_end) {
+                word_end = std::min(word_end, max_nr_of_words[i * 4 + dpu_id]);
+                if (word_begin >= word_end) {
+                    return;
+                }
+                RaggedBufferSink sink{&buffers_aligned[i * MAX_NR_DPUS_PER_RANK],
+                                      &nr_of_words[i * MAX_NR_DPUS_PER_RANK]};
+                ReceiveFromRankMRAM(sink, symbol_offset, base_addrs[i], dpu_id,
+                                    word_begin, word_end);
+            });
+        return result;
+    }
+
+    // MRAM address of a symbol, resolved once for the small-transfer path.
+    uint32_t GetMRAMSymbolAddress(const std::string &symbol_name) {
+        uint32_t symbol_base_offset = GetSymbolOffset(symbol_name);
+        assert(symbol_base_offset & MRAM_ADDRESS_SPACE);
+        return symbol_base_offset ^ MRAM_ADDRESS_SPACE;
+    }
+
+    // Bytes from DPU_MRAM_HEAP_POINTER to the end of MRAM.
+    uint32_t GetMRAMHeapSize() {
+        return MRAM_SIZE - GetMRAMSymbolAddress(DPU_MRAM_HEAP_POINTER_NAME);
+    }
+
+    // Low-latency path for at most MAX_SMALL_TRANSFER_SIZE bytes per DPU,
+    // e.g. query keys or parameters. `mram_address` comes from
+    // GetMRAMSymbolAddress plus the offset. One task per rank, with kernels
+    // specialized on the word count and on whether the rank is fully enabled.
+    void SendToPIMSmall(uint8_t **buffers, uint32_t buffer_offset,
+                        uint32_t mram_address, uint32_t length) {
+        SmallTransfer<true>(buffers, buffer_offset, mram_address, length);
+    }
+
+    void ReceiveFromPIMSmall(uint8_t **buffers, uint32_t buffer_offset,
+                             uint32_t mram_address, uint32_t length) {
+        SmallTransfer<false>(buffers, buffer_offset, mram_address, length);
+    }
+
+    // Same, with the length fixed at compile time.
+    template <uint32_t LENGTH>
+    void SendToPIMSmall(uint8_t **buffers, uint32_t buffer_offset,
+                        uint32_t mram_address) {
+        static_assert(LENGTH % sizeof(uint64_t) == 0 && LENGTH > 0 &&
+                          LENGTH <= MAX_SMALL_TRANSFER_SIZE,
+                      "invalid small transfer length");
+        SmallTransfer<true>(buffers, buffer_offset, mram_address, LENGTH);
+    }
+
+    template <uint32_t LENGTH>
+    void ReceiveFromPIMSmall(uint8_t **buffers, uint32_t buffer_offset,
+                             uint32_t mram_address) {
+        static_assert(LENGTH % sizeof(uint64_t) == 0 && LENGTH > 0 &&
+                          LENGTH <= MAX_SMALL_TRANSFER_SIZE,
+                      "invalid small transfer length");
+        SmallTransfer<false>(buffers, buffer_offset, mram_address, LENGTH);
     }
 
     void ReceiveFromPIM(uint8_t **buffers, uint32_t buffer_offset, std::string symbol_name,
@@ -443,32 +1548,491 @@ class DirectPIMInterface : public PIMInterface {
         uint32_t symbol_base_offset = GetSymbolOffset(symbol_name);
 
         // Skip disabled PIM modules
-        uint8_t *buffers_aligned[MAX_NR_RANKS * MAX_NR_DPUS_PER_RANK];
+        std::vector<uint8_t *> buffers_aligned(nr_of_ranks *
+                                               MAX_NR_DPUS_PER_RANK);
+        AlignBuffers(buffers, buffer_offset, buffers_aligned.data());
+
+        if (symbol_base_offset & MRAM_ADDRESS_SPACE) {  // receive from mram
+            // Only support heap pointer at present
+            assert(symbol_name == DPU_MRAM_HEAP_POINTER_NAME);
+            ReceiveFromMRAM(buffers_aligned.data(), symbol_base_offset,
+                            symbol_offset, length, async_transfer);
+        } else {  // receive from wram
+            ReceiveFromWRAM(buffers_aligned.data(), symbol_base_offset,
+                            symbol_offset, length, async_transfer);
+        }
+    }
+
+    // Send lengths[i] bytes (a multiple of 8) from buffers[i] to every DPU.
+    // Up to the longest DPU of its (rank, dpu_id group), a shorter DPU gets
+    // zeros after its own bytes; further MRAM is untouched.
+    void SendRaggedToPIM(uint8_t **buffers, const uint64_t *lengths,
+                         std::string symbol_name, uint32_t symbol_offset) {
+        assert(DirectAvailable(false));
+        symbol_offset += GetMRAMSymbolAddress(symbol_name);
+
+        std::vector<uint8_t *> buffers_aligned(nr_of_ranks *
+                                               MAX_NR_DPUS_PER_RANK);
+        AlignBuffers(buffers, 0, buffers_aligned.data());
+        std::vector<uint32_t> nr_of_words, max_nr_of_words;
+        uint32_t nr_of_words_all =
+            GetRaggedWordCounts(lengths, nr_of_words, max_nr_of_words);
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + nr_of_words_all * sizeof(uint64_t) <=
+               MRAM_SIZE);
+
+        ForEachRankTask(
+            nr_of_words_all, [&](size_t i, uint32_t dpu_id,
+                                 uint32_t word_begin, uint32_t word_end) {
+                word_end = std::min(word_end, max_nr_of_words[i * 4 + dpu_id]);
+                if (word_begin >= word_end) {
+                    return;
+                }
+                RaggedBufferSource source{
+                    &buffers_aligned[i * MAX_NR_DPUS_PER_RANK],
+                    &nr_of_words[i * MAX_NR_DPUS_PER_RANK]};
+                SendToRankMRAM(source, symbol_offset, base_addrs[i], dpu_id,
+                               word_begin, word_end);
+            });
+    }
+
+    // Bytes SendRaggedToPIM(buffers, lengths, ...) writes to each DPU:
+    // lengths[i] rounded up to 8, raised to the longest of its group.
+    std::vector<uint64_t> GetRaggedWriteExtents(const uint64_t *lengths) {
+        std::vector<uint32_t> nr_of_words, max_nr_of_words;
+        GetRaggedWordCounts(lengths, nr_of_words, max_nr_of_words);
+        std::vector<uint64_t> extents(nr_of_dpus);
+        for (uint32_t i = 0, dpu = 0; i < nr_of_ranks; i++) {
+            for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+                if (ranks[i]->dpus[j].enabled) {
+                    extents[dpu++] =
+                        max_nr_of_words[i * 4 + j % 4] * sizeof(uint64_t);
+                }
+            }
+        }
+        return extents;
+    }
+
+    // Bucket records[0, nr_of_records) by DPU ID partition(record) straight
+    // into MRAM: DPU i gets its records, in input order, contiguously from
+    // symbol_name + symbol_offset. Returns the number of records per DPU.
+    // Only a 4-byte index per record is staged, never the records.
+    template <typename Record, typename Partition>
+    std::vector<uint64_t> ScatterToPIM(const Record *records,
+                                       size_t nr_of_records,
+                                       Partition partition,
+                                       std::string symbol_name,
+                                       uint32_t symbol_offset) {
+        static_assert(sizeof(Record) % sizeof(uint64_t) == 0,
+                      "record size must be a multiple of 8 bytes");
+        assert(DirectAvailable(false));
+        assert(nr_of_records <= UINT32_MAX);
+        symbol_offset += GetMRAMSymbolAddress(symbol_name);
+
+        std::vector<uint32_t> order;
+        std::vector<uint64_t> begin;
+        SortByDPU(
+            nr_of_records, [&](size_t k) { return partition(records[k]); },
+            order, begin);
+        std::vector<uint64_t> counts(nr_of_dpus);
+        for (size_t d = 0; d < nr_of_dpus; d++) {
+            counts[d] = begin[d + 1] - begin[d];
+        }
+
+        std::vector<uint64_t> lengths(nr_of_dpus);
+        std::vector<uint64_t> slot_begin(nr_of_ranks * MAX_NR_DPUS_PER_RANK, 0);
+        for (size_t d = 0; d < nr_of_dpus; d++) {
+            lengths[d] = counts[d] * sizeof(Record);
+        }
+        for (size_t k = 0; k < slot_begin.size(); k++) {
+            if (dpuIDOfSlot[k] >= 0) {
+                slot_begin[k] = begin[dpuIDOfSlot[k]];
+            }
+        }
+        std::vector<uint32_t> nr_of_words, max_nr_of_words;
+        uint32_t nr_of_words_all =
+            GetRaggedWordCounts(lengths.data(), nr_of_words, max_nr_of_words);
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + nr_of_words_all * sizeof(uint64_t) <=
+               MRAM_SIZE);
+
+        ForEachRankTask(
+            nr_of_words_all, [&](size_t i, uint32_t dpu_id,
+                                 uint32_t word_begin, uint32_t word_end) {
+                word_end = std::min(word_end, max_nr_of_words[i * 4 + dpu_id]);
+                if (word_begin >= word_end) {
+                    return;
+                }
+                ScatterSource<Record> source{
+                    records, order.data(),
+                    &slot_begin[i * MAX_NR_DPUS_PER_RANK],
+                    &nr_of_words[i * MAX_NR_DPUS_PER_RANK]};
+                SendToRankMRAM(source, symbol_offset, base_addrs[i], dpu_id,
+                               word_begin, word_end);
+            });
+        return counts;
+    }
+
+    // DPU-to-DPU exchange through the host. The outbox of every DPU, at
+    // outbox_symbol + outbox_offset, holds uint32_t lengths[nr_of_dpus]
+    // (bytes for each destination, multiples of 8) padded to 8 bytes, then
+    // the segments in destination order. The inbox of every DPU, at
+    // inbox_symbol + inbox_offset, receives PIMAllToAllEntry[nr_of_dpus],
+    // one per source DPU, followed by the data. Outboxes and inboxes must
+    // not overlap. Returns the inbox bytes used, or UINT64_MAX, without
+    // writing any inbox, if they would exceed max_inbox_size or MRAM.
+    //
+    // Source ranks are handled one round at a time, grouped by NUMA node:
+    // a round reads the outboxes of one rank into a staging buffer on that
+    // rank's node and writes them out to all ranks while the next round's
+    // outboxes are read. Only two ranks' outboxes are staged at any time.
+    // Within a round every destination gets the same inbox slot size, so
+    // inbox data may have gaps between rounds.
+    uint64_t AllToAll(std::string outbox_symbol, uint32_t outbox_offset,
+                      std::string inbox_symbol, uint32_t inbox_offset,
+                      uint32_t max_inbox_size) {
+        assert(DirectAvailable(false));
+        const uint32_t stride =
+            (nr_of_dpus + 1) / 2 * 2;  // lengths row padded to 8 bytes
+        const uint32_t outbox_header = stride * sizeof(uint32_t);
+        const uint32_t inbox_header = nr_of_dpus * sizeof(PIMAllToAllEntry);
+
+        // Outbox headers, and where each segment starts in its outbox data.
+        std::vector<uint32_t> lengths((size_t)nr_of_dpus * stride);
+        std::vector<uint32_t> segment_offsets((size_t)nr_of_dpus * stride);
+        std::vector<uint64_t> outbox_size(nr_of_dpus);
         {
-            uint32_t offset = 0;
+            std::vector<uint8_t *> rows(nr_of_dpus);
+            for (uint32_t s = 0; s < nr_of_dpus; s++) {
+                rows[s] = (uint8_t *)&lengths[(size_t)s * stride];
+            }
+            ReceiveFromPIM(rows.data(), 0, outbox_symbol, outbox_offset,
+                           outbox_header, false);
+        }
+        ParallelFor(0, nr_of_dpus, [&](size_t s) {
+            uint64_t offset = 0;
+            for (uint32_t d = 0; d < nr_of_dpus; d++) {
+                assert(aligned(lengths[s * stride + d], sizeof(uint64_t)));
+                segment_offsets[s * stride + d] = (uint32_t)offset;
+                offset += lengths[s * stride + d];
+            }
+            outbox_size[s] = offset;
+        });
+
+        // Rounds: one per source rank, ordered by NUMA node.
+        std::vector<uint32_t> round_rank(nr_of_ranks);
+        for (uint32_t r = 0; r < nr_of_ranks; r++) {
+            round_rank[r] = r;
+        }
+        std::stable_sort(round_rank.begin(), round_rank.end(),
+                         [&](uint32_t a, uint32_t b) {
+                             return ranks[a]->numa_node < ranks[b]->numa_node;
+                         });
+
+        // Bytes every destination gets per round, the longest destination of
+        // each round and (round, destination rank, dpu_id group), and the
+        // inbox headers.
+        std::vector<uint64_t> round_bytes((size_t)nr_of_ranks * nr_of_dpus);
+        ParallelFor(0, nr_of_dpus, [&](size_t d) {
+            for (uint32_t r = 0; r < nr_of_ranks; r++) {
+                uint64_t total = 0;
+                for (size_t s = firstDPUIDOfRank[round_rank[r]];
+                     s < firstDPUIDOfRank[round_rank[r] + 1]; s++) {
+                    total += lengths[s * stride + d];
+                }
+                round_bytes[(size_t)r * nr_of_dpus + d] = total;
+            }
+        });
+        std::vector<uint64_t> round_base(nr_of_ranks + 1);
+        std::vector<uint32_t> max_nr_of_words((size_t)nr_of_ranks *
+                                              nr_of_ranks * 4);
+        round_base[0] = inbox_header;
+        for (uint32_t r = 0; r < nr_of_ranks; r++) {
+            uint64_t slot = 0;
             for (uint32_t i = 0; i < nr_of_ranks; i++) {
                 for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
-                    if (ranks[i]->dpus[j].enabled) {
-                        buffers_aligned[i * MAX_NR_DPUS_PER_RANK + j] =
-                            buffers[offset++] + buffer_offset;
-                    } else {
-                        buffers_aligned[i * MAX_NR_DPUS_PER_RANK + j] =
-                            nullptr;
+                    int32_t d = dpuIDOfSlot[i * MAX_NR_DPUS_PER_RANK + j];
+                    if (d < 0) {
+                        continue;
                     }
+                    uint32_t words = round_bytes[(size_t)r * nr_of_dpus + d] /
+                                     sizeof(uint64_t);
+                    uint32_t &group_max =
+                        max_nr_of_words[((size_t)r * nr_of_ranks + i) * 4 +
+                                        j % 4];
+                    group_max = std::max(group_max, words);
+                    slot = std::max(slot, (uint64_t)words * sizeof(uint64_t));
                 }
             }
-            assert(offset == nr_of_dpus);
+            round_base[r + 1] = round_base[r] + slot;
+        }
+        uint64_t inbox_size = round_base[nr_of_ranks];
+        uint32_t inbox_address = GetMRAMSymbolAddress(inbox_symbol) + inbox_offset;
+        if (inbox_size > max_inbox_size ||
+            (uint64_t)inbox_address + inbox_size > MRAM_SIZE) {
+            return UINT64_MAX;
         }
 
-        if (symbol_base_offset & MRAM_ADDRESS_SPACE) {  // receive from mram
-            // Only support heap pointer at present
-            assert(symbol_name == DPU_MRAM_HEAP_POINTER_NAME);
-            ReceiveFromMRAM(buffers_aligned, symbol_base_offset, symbol_offset,
-                            length, async_transfer);
-        } else {  // receive from wram
-            ReceiveFromWRAM(buffers_aligned, symbol_base_offset, symbol_offset,
-                            length, async_transfer);
+        std::vector<PIMAllToAllEntry> entries((size_t)nr_of_dpus * nr_of_dpus);
+        ParallelFor(0, nr_of_dpus, [&](size_t d) {
+            for (uint32_t r = 0; r < nr_of_ranks; r++) {
+                uint64_t offset = round_base[r];
+                for (size_t s = firstDPUIDOfRank[round_rank[r]];
+                     s < firstDPUIDOfRank[round_rank[r] + 1]; s++) {
+                    uint32_t length = lengths[s * stride + d];
+                    entries[d * nr_of_dpus + s] = {(uint32_t)offset, length};
+                    offset += length;
+                }
+            }
+        });
+        {
+            std::vector<uint8_t *> rows(nr_of_dpus);
+            for (uint32_t d = 0; d < nr_of_dpus; d++) {
+                rows[d] = (uint8_t *)&entries[(size_t)d * nr_of_dpus];
+            }
+            SendToPIM(rows.data(), 0, inbox_symbol, inbox_offset,
+                      inbox_header, false);
+        }
+
+        uint32_t outbox_address =
+            GetMRAMSymbolAddress(outbox_symbol) + outbox_offset + outbox_header;
+
+        // Two staging buffers, reused while the rounds stay on one node.
+        struct Staging {
+            uint8_t *data = nullptr;
+            size_t size = 0;
+            int node = -1;
+            uint8_t *slots[MAX_NR_DPUS_PER_RANK];
+            uint32_t nr_of_words[MAX_NR_DPUS_PER_RANK];
+        } staging[2];
+        std::vector<uint64_t> node_staging_size;
+        for (uint32_t r = 0; r < nr_of_ranks; r++) {
+            uint64_t size = 0;
+            for (size_t s = firstDPUIDOfRank[r]; s < firstDPUIDOfRank[r + 1];
+                 s++) {
+                size += outbox_size[s];
+            }
+            size_t node = std::max(ranks[r]->numa_node, 0);
+            node_staging_size.resize(
+                std::max(node_staging_size.size(), node + 1), 0);
+            node_staging_size[node] = std::max(node_staging_size[node], size);
+        }
+
+        ParallelFor(0, nr_of_ranks, [&](size_t i) { SwitchMuxToHost(i); });
+
+        auto ReadRound = [&](uint32_t r) {
+            Staging &st = staging[r % 2];
+            uint32_t rank_id = round_rank[r];
+            int node = std::max(ranks[rank_id]->numa_node, 0);
+            if (st.node != node) {
+                if (st.data != nullptr) {
+                    munmap(st.data, st.size);
+                }
+                st.size = std::max(node_staging_size[node], (uint64_t)1);
+                st.data = AllocateOnNUMANode(st.size, node);
+                st.node = node;
+            }
+            uint64_t offset = 0;
+            uint32_t nr_of_words_all = 0;
+            uint32_t group_words[4] = {0, 0, 0, 0};
+            for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
+                int32_t s = dpuIDOfSlot[rank_id * MAX_NR_DPUS_PER_RANK + j];
+                uint64_t size = s < 0 ? 0 : outbox_size[s];
+                st.slots[j] = st.data + offset;
+                st.nr_of_words[j] = size / sizeof(uint64_t);
+                group_words[j % 4] =
+                    std::max(group_words[j % 4], st.nr_of_words[j]);
+                nr_of_words_all = std::max(nr_of_words_all, st.nr_of_words[j]);
+                offset += size;
+            }
+            assert((uint64_t)outbox_address +
+                       nr_of_words_all * sizeof(uint64_t) <=
+                   MRAM_SIZE);
+            ForEachTaskOfRanks(
+                rank_id, rank_id + 1, nr_of_words_all,
+                [&](size_t i, uint32_t dpu_id, uint32_t word_begin,
+                    uint32_t word_end) {
+                    word_end = std::min(word_end, group_words[dpu_id]);
+                    if (word_begin >= word_end) {
+                        return;
+                    }
+                    RaggedBufferSink sink{st.slots, st.nr_of_words};
+                    ReceiveFromRankMRAM(sink, outbox_address, base_addrs[i],
+                                        dpu_id, word_begin, word_end);
+                });
+        };
+
+        auto SendRound = [&](uint32_t r) {
+            Staging &st = staging[r % 2];
+            uint32_t nr_of_words_all =
+                (round_base[r + 1] - round_base[r]) / sizeof(uint64_t);
+            ForEachTaskOfRanks(
+                0, nr_of_ranks, nr_of_words_all,
+                [&](size_t i, uint32_t dpu_id, uint32_t word_begin,
+                    uint32_t word_end) {
+                    word_end = std::min(
+                        word_end,
+                        max_nr_of_words[((size_t)r * nr_of_ranks + i) * 4 +
+                                        dpu_id]);
+                    if (word_begin >= word_end) {
+                        return;
+                    }
+                    AllToAllSource source;
+                    source.lengths = lengths.data();
+                    source.segment_offsets = segment_offsets.data();
+                    source.stride = stride;
+                    source.source_dpus =
+                        &dpuIDOfSlot[round_rank[r] * MAX_NR_DPUS_PER_RANK];
+                    source.dest_dpus = &dpuIDOfSlot[i * MAX_NR_DPUS_PER_RANK];
+                    source.staging = st.slots;
+                    source.Seek(dpu_id, word_begin);
+                    SendToRankMRAM(source, inbox_address + round_base[r],
+                                   base_addrs[i], dpu_id, word_begin, word_end);
+                });
+        };
+
+        ReadRound(0);
+        for (uint32_t r = 0; r < nr_of_ranks; r++) {
+            ParallelFor(0, 2, [&](size_t k) {
+                if (k == 0) {
+                    SendRound(r);
+                } else if (r + 1 < nr_of_ranks) {
+                    ReadRound(r + 1);
+                }
+            });
+        }
+        for (Staging &st : staging) {
+            if (st.data != nullptr) {
+                munmap(st.data, st.size);
+            }
         }
+        return inbox_size;
+    }
+
+    // Send only the dirty blocks of [symbol_offset, symbol_offset + length):
+    // bit b of dirty_bitmaps[i] marks bytes [b * block_size, (b + 1) *
+    // block_size) of buffers[i]. DPUs sharing MRAM cache lines (the 16 DPUs
+    // of a rank's dpu_id group) are written together, so a block dirty on
+    // one of them is also rewritten from the buffers of the other 15; the
+    // buffers must match MRAM outside the dirty blocks. Runs of consecutive
+    // blocks are sent as one range. Returns the bytes written to MRAM.
+    uint64_t SendDirtyBlocksToPIM(uint8_t **buffers, std::string symbol_name,
+                                  uint32_t symbol_offset, uint32_t length,
+                                  uint32_t block_size,
+                                  const uint64_t *const *dirty_bitmaps) {
+        assert(DirectAvailable(false));
+        symbol_offset += GetMRAMSymbolAddress(symbol_name);
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert(aligned(length, sizeof(uint64_t)));
+        assert(aligned(block_size, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
+
+        std::vector<uint8_t *> buffers_aligned(nr_of_ranks *
+                                               MAX_NR_DPUS_PER_RANK);
+        AlignBuffers(buffers, 0, buffers_aligned.data());
+
+        // Union of the dirty blocks of each (rank, dpu_id group), as runs.
+        struct Task {
+            uint32_t rank_id, dpu_id, word_begin, word_end;
+        };
+        const uint32_t nr_of_blocks = (length + block_size - 1) / block_size;
+        const uint32_t nr_of_bitmap_words = (nr_of_blocks + 63) / 64;
+        const uint32_t block_words = block_size / sizeof(uint64_t);
+        const uint32_t length_words = length / sizeof(uint64_t);
+        std::vector<std::vector<Task>> group_tasks(nr_of_ranks * 4);
+        ParallelFor(0, nr_of_ranks * 4, [&](size_t g) {
+            uint32_t rank_id = g / 4, dpu_id = g % 4;
+            std::vector<uint64_t> dirty(nr_of_bitmap_words, 0);
+            for (int j = dpu_id; j < MAX_NR_DPUS_PER_RANK; j += 4) {
+                int32_t dpu = dpuIDOfSlot[rank_id * MAX_NR_DPUS_PER_RANK + j];
+                if (dpu < 0) {
+                    continue;
+                }
+                for (uint32_t w = 0; w < nr_of_bitmap_words; w++) {
+                    dirty[w] |= dirty_bitmaps[dpu][w];
+                }
+            }
+            uint32_t b = 0;
+            while (b < nr_of_blocks) {
+                if (!((dirty[b / 64] >> (b % 64)) & 1)) {
+                    b++;
+                    continue;
+                }
+                uint32_t run_begin = b;
+                while (b < nr_of_blocks && ((dirty[b / 64] >> (b % 64)) & 1)) {
+                    b++;
+                }
+                // Long runs are split so that ranks with more changes are
+                // shared among more workers.
+                uint32_t word_end = std::min(b * block_words, length_words);
+                for (uint32_t w = run_begin * block_words; w < word_end;
+                     w += MIN_WORDS_PER_TASK * 8) {
+                    group_tasks[g].push_back(
+                        {rank_id, dpu_id, w,
+                         std::min(word_end, w + MIN_WORDS_PER_TASK * 8)});
+                }
+            }
+        });
+
+        std::vector<Task> tasks;
+        uint64_t nr_of_words_sent = 0;
+        for (auto &group : group_tasks) {
+            for (const Task &task : group) {
+                nr_of_words_sent += task.word_end - task.word_begin;
+                tasks.push_back(task);
+            }
+        }
+        if (tasks.empty()) {
+            return 0;
+        }
+
+        ParallelFor(0, nr_of_ranks, [&](size_t i) { SwitchMuxToHost(i); });
+        ParallelFor(0, tasks.size(), [&](size_t t) {
+            const Task &task = tasks[t];
+            PIM_TRACE_SCOPE("task", task.rank_id);
+            SendToRankMRAM(
+                &buffers_aligned[task.rank_id * MAX_NR_DPUS_PER_RANK],
+                symbol_offset, base_addrs[task.rank_id], task.dpu_id,
+                task.word_begin, task.word_end);
+        });
+        return nr_of_words_sent * sizeof(uint64_t) * 16;
+    }
+
+    // Run several MRAM transfers, in order, in a single pass with one
+    // worker per rank; per-transfer overhead (task fan-out, mux switches,
+    // fences) is paid once per batch instead.
+    void ExecuteBatch(const std::vector<PIMTransferCommand> &commands) {
+        assert(DirectAvailable(false));
+        std::vector<ResolvedTransfer> transfers = ResolveBatch(commands);
+        ParallelFor(0, nr_of_ranks, [&](size_t i) {
+            ExecuteBatchOnRank(i, transfers);
+        });
+    }
+
+    // ExecuteBatch in the background, on the private pool if there is one,
+    // otherwise on a pool of one thread per rank started by the first call
+    // and kept with the interface, so a round costs no thread creation.
+    // Until the future is ready, the batch's buffers must not be touched
+    // and no other transfer may be issued on this interface.
+    std::future<void> ExecuteBatchAsync(
+        const std::vector<PIMTransferCommand> &commands) {
+        assert(DirectAvailable(false));
+        auto transfers = std::make_shared<std::vector<ResolvedTransfer>>(
+            ResolveBatch(commands));
+        PIMWorkerPool *pool = private_pool.get();
+        if (pool == nullptr) {
+            if (batch_pool == nullptr) {
+                // One worker per rank; the one running the task joins in.
+                batch_pool.reset(new PIMWorkerPool(nr_of_ranks + 1));
+            }
+            pool = batch_pool.get();
+        }
+        return pool->Async([this, pool, transfers]() {
+            auto TransferIthRank = [&](size_t i) {
+                ExecuteBatchOnRank(i, *transfers);
+            };
+            pool->ParallelFor(0, nr_of_ranks, TransferIthRank);
+        });
     }
 
     void SendToPIM(uint8_t **buffers, uint32_t buffer_offset, std::string symbol_name,
@@ -481,40 +2045,48 @@ class DirectPIMInterface : public PIMInterface {
         symbol_offset += GetSymbolOffset(symbol_name) ^ MRAM_ADDRESS_SPACE;
 
         // Skip disabled PIM modules
-        uint8_t *buffers_aligned[MAX_NR_RANKS * MAX_NR_DPUS_PER_RANK];
-        {
-            uint32_t offset = 0;
-            for (uint32_t i = 0; i < nr_of_ranks; i++) {
-                for (int j = 0; j < MAX_NR_DPUS_PER_RANK; j++) {
-                    if (ranks[i]->dpus[j].enabled) {
-                        buffers_aligned[i * MAX_NR_DPUS_PER_RANK + j] =
-                            buffers[offset++] + buffer_offset;
-                    } else {
-                        buffers_aligned[i * MAX_NR_DPUS_PER_RANK + j] =
-                            nullptr;
-                    }
-                }
-            }
-            assert(offset == nr_of_dpus);
-        }
+        std::vector<uint8_t *> buffers_aligned(nr_of_ranks *
+                                               MAX_NR_DPUS_PER_RANK);
+        AlignBuffers(buffers, buffer_offset, buffers_aligned.data());
 
-        auto SendToIthRank = [&](size_t i) {
-            DPU_ASSERT(dpu_switch_mux_for_rank(ranks[i], true));
-            SendToRankMRAM(&buffers_aligned[i * MAX_NR_DPUS_PER_RANK],
-                           symbol_offset, base_addrs[i], length);
-        };
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert(aligned(length, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
 
-        parlay::parallel_for(
-            0, nr_of_ranks,
-            [&](size_t i) {
-                SendToIthRank(i);
-            },
-            1, false);
+        ForEachRankTask(length / sizeof(uint64_t),
+                        [&](size_t i, uint32_t dpu_id, uint32_t word_begin,
+                            uint32_t word_end) {
+                            SendToRankMRAM(
+                                &buffers_aligned[i * MAX_NR_DPUS_PER_RANK],
+                                symbol_offset, base_addrs[i], dpu_id,
+                                word_begin, word_end);
+                        });
+    }
 
-        // Find physical address for each rank
-        // for (uint32_t i = 0; i < nr_of_ranks; i++) {
-        //     SendToIthRank(i);
-        // }
+    // SendToPIM of data computed during the transfer, without per-DPU host
+    // buffers: generator(dpu_id, word_begin, nr_of_words, words) writes
+    // words [word_begin, word_begin + nr_of_words) of DPU dpu_id, at most 8
+    // and starting at a multiple of 8, to `words`. It is called
+    // concurrently from the transfer threads, once per line of every DPU.
+    template <typename Generator>
+    void SendGeneratedToPIM(Generator generator, std::string symbol_name,
+                            uint32_t symbol_offset, uint32_t length) {
+        assert(DirectAvailable(false));
+        symbol_offset += GetMRAMSymbolAddress(symbol_name);
+        assert(aligned(symbol_offset, sizeof(uint64_t)));
+        assert(aligned(length, sizeof(uint64_t)));
+        assert((uint64_t)symbol_offset + length <= MRAM_SIZE);
+
+        uint32_t nr_of_words = length / sizeof(uint64_t);
+        ForEachRankTask(
+            nr_of_words, [&](size_t i, uint32_t dpu_id, uint32_t word_begin,
+                             uint32_t word_end) {
+                GeneratorSource<Generator> source(
+                    generator, &dpuIDOfSlot[i * MAX_NR_DPUS_PER_RANK],
+                    nr_of_words);
+                SendToRankMRAM(source, symbol_offset, base_addrs[i], dpu_id,
+                               word_begin, word_end);
+            });
     }
 
     size_t GetNUMAIDOfDPU(size_t dpu_id) {
@@ -522,6 +2094,36 @@ class DirectPIMInterface : public PIMInterface {
         return ranks[rankIDOfDPU[dpu_id]]->numa_node;
     }
 
+    // Tasks per rank for MRAM transfers. Work is split by dpu_id group first,
+    // then by MRAM offset range.
+    void SetNrOfTasksPerRank(uint32_t nr_of_tasks) {
+        assert(nr_of_tasks > 0);
+        nr_of_tasks_per_rank = nr_of_tasks;
+    }
+
+    uint32_t GetNrOfTasksPerRank() const { return nr_of_tasks_per_rank; }
+
+    // Kernel parameters, loaded from the machine profile at construction.
+    void SetTransferParameters(const PIMTransferParameters &parameters) {
+        assert(parameters.buffer_prefetch_words % 8 == 0);
+        transfer_parameters = parameters;
+        if (parameters.nr_of_tasks_per_rank != 0) {
+            nr_of_tasks_per_rank = parameters.nr_of_tasks_per_rank;
+        }
+    }
+
+    PIMTransferParameters GetTransferParameters() const {
+        PIMTransferParameters parameters = transfer_parameters;
+        parameters.nr_of_tasks_per_rank = nr_of_tasks_per_rank;
+        return parameters;
+    }
+
+    // DPUs of rank i are [GetFirstDPUIDOfRank(i), GetFirstDPUIDOfRank(i + 1)).
+    size_t GetFirstDPUIDOfRank(size_t rank_id) {
+        assert(rank_id <= nr_of_ranks && firstDPUIDOfRank != nullptr);
+        return firstDPUIDOfRank[rank_id];
+    }
+
     size_t GetRankIDOfDPU(size_t dpu_id) {
         assert(dpu_id < nr_of_dpus && rankIDOfDPU != nullptr);
         return rankIDOfDPU[dpu_id];
@@ -540,6 +2142,9 @@ class DirectPIMInterface : public PIMInterface {
         if (rankIDOfDPU != nullptr) {
             delete[] rankIDOfDPU;
         }
+        if (firstDPUIDOfRank != nullptr) {
+            delete[] firstDPUIDOfRank;
+        }
     }
 
    private:
@@ -578,6 +2183,11 @@ class DirectPIMInterface : public PIMInterface {
         _mm512_storeu_si512((__m512i *)output, final);
     }
 
+   public:
+    static const uint32_t MAX_SMALL_TRANSFER_WORDS = 32;
+    static const uint32_t MAX_SMALL_TRANSFER_SIZE =
+        MAX_SMALL_TRANSFER_WORDS * sizeof(uint64_t);
+
    protected:
     const int MRAM_ADDRESS_SPACE = 0x8000000;
     dpu_rank_t **ranks;
@@ -585,5 +2195,15 @@ class DirectPIMInterface : public PIMInterface {
     uint8_t **base_addrs;
     dpu_program_t *program;
     size_t* rankIDOfDPU;
-    // map<std::string, uint32_t> offset_list;
+    size_t* firstDPUIDOfRank;
+    uint32_t nr_of_tasks_per_rank;
+    PIMTransferParameters transfer_parameters;
+    // 8 KB per DPU: below this, splitting costs more than it gains
+    const uint32_t MIN_WORDS_PER_TASK = 1 << 10;
+    std::unordered_map<std::string, uint32_t> offset_list;
+    // DPU ID of each (rank, slot), -1 if disabled; fully enabled ranks
+    std::vector<int32_t> dpuIDOfSlot;
+    std::vector<uint8_t> rankFullyEnabled;
+    // Runs ExecuteBatchAsync without a private pool.
+    std::unique_ptr<PIMWorkerPool> batch_pool;
 };
\ No newline at end of file
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "direct_interface.hpp"
+#include "kv_lookup_layout.h"
+#include "mram_allocator.hpp"
+
+// Point lookups into a hash table partitioned over the DPUs' MRAM, for a
+// DPU program built around the kv_lookup kernel (src/kv_lookup/dpu.c).
+// Keys go to DPU kv_hash(key) >> 32 modulo the number of DPUs. A lookup
+// batch is routed by DPU, sent, answered in place by all tasklets of every
+// DPU and scattered back into the caller's order; batches with more than
+// max_queries_per_dpu keys for one DPU take several launches. On the direct
+// interface, rounds of up to MAX_SMALL_TRANSFER_SIZE bytes per DPU take the
+// small-transfer kernels.
+class PIMKVStore {
+   public:
+    PIMKVStore(PIMInterface *interface, PIMMRAMAllocator *allocator,
+               uint32_t max_queries_per_dpu = 1 << 14)
+        : interface(interface),
+          allocator(allocator),
+          max_queries_per_dpu(max_queries_per_dpu) {
+        nr_of_dpus = interface->GetNrOfDPUs();
+        bool allocated =
+            allocator->Allocate(KV_BATCH_REGION,
+                                sizeof(kv_batch_header_t) +
+                                    max_queries_per_dpu * sizeof(uint64_t)) !=
+            nullptr;
+        assert(allocated);
+        (void)allocated;
+        direct = dynamic_cast<DirectPIMInterface *>(interface);
+        if (direct != nullptr) {
+            batch_address =
+                direct->GetMRAMSymbolAddress(DPU_MRAM_HEAP_POINTER_NAME) +
+                allocator->Get(KV_BATCH_REGION).offset;
+        }
+
+        size_t batch_words = 1 + (size_t)max_queries_per_dpu;
+        batch_data.reset(new uint64_t[nr_of_dpus * batch_words]);
+        batch_buffers.resize(nr_of_dpus);
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            batch_buffers[i] = (uint8_t *)&batch_data[i * batch_words];
+        }
+    }
+
+    uint32_t DPUOfKey(uint64_t key) const {
+        return (kv_hash(key) >> 32) % nr_of_dpus;
+    }
+
+    // Replace the table with the n pairs, the last value winning for
+    // repeated keys. Every DPU gets the same power-of-two capacity, at
+    // least twice the entries of the fullest DPU.
+    void Build(const uint64_t *keys, const uint64_t *values, size_t n) {
+        std::vector<uint32_t> order;
+        std::vector<uint64_t> begin;
+        interface->SortByDPU(
+            n, [&](size_t k) { return DPUOfKey(keys[k]); }, order, begin);
+        uint64_t max_count = 0;
+        for (uint32_t d = 0; d < nr_of_dpus; d++) {
+            max_count = std::max(max_count, begin[d + 1] - begin[d]);
+        }
+        capacity = KV_PROBE_WINDOW;
+        while (capacity < 2 * max_count) {
+            capacity *= 2;
+        }
+
+        uint32_t table_size =
+            sizeof(kv_table_header_t) + capacity * sizeof(kv_entry_t);
+        if (table_allocated) {
+            allocator->Free(KV_TABLE_REGION);
+        }
+        table_allocated =
+            allocator->Allocate(KV_TABLE_REGION, table_size) != nullptr;
+        assert(table_allocated);
+        allocator->Publish();
+
+        std::unique_ptr<uint8_t[]> tables(
+            new uint8_t[(size_t)nr_of_dpus * table_size]);
+        std::vector<uint8_t *> table_buffers(nr_of_dpus);
+        interface->ParallelFor(0, nr_of_dpus, [&](size_t d) {
+            uint8_t *table = &tables[d * table_size];
+            table_buffers[d] = table;
+            kv_entry_t *entries =
+                (kv_entry_t *)(table + sizeof(kv_table_header_t));
+            for (uint32_t s = 0; s < capacity; s++) {
+                entries[s] = {KV_EMPTY_KEY, 0};
+            }
+            uint32_t nr_of_entries = 0;
+            for (uint64_t j = begin[d]; j < begin[d + 1]; j++) {
+                uint64_t key = keys[order[j]];
+                assert(key != KV_EMPTY_KEY);
+                assert(values[order[j]] != KV_MISSING_VALUE);
+                uint32_t s = kv_hash(key) & (capacity - 1);
+                while (entries[s].key != KV_EMPTY_KEY &&
+                       entries[s].key != key) {
+                    s = (s + 1) & (capacity - 1);
+                }
+                nr_of_entries += entries[s].key == KV_EMPTY_KEY;
+                entries[s] = {key, values[order[j]]};
+            }
+            kv_table_header_t header = {capacity, nr_of_entries};
+            memcpy(table, &header, sizeof(header));
+        });
+        allocator->Send(KV_TABLE_REGION, table_buffers.data(), 0, 0,
+                        table_size);
+    }
+
+    // values[k] is the value of keys[k], or KV_MISSING_VALUE.
+    void Lookup(const uint64_t *keys, size_t n, uint64_t *values) {
+        assert(table_allocated);
+        nr_of_rounds = 0;
+        if (n == 0) {
+            return;
+        }
+        std::vector<uint32_t> order;
+        std::vector<uint64_t> begin;
+        interface->SortByDPU(
+            n, [&](size_t k) { return DPUOfKey(keys[k]); }, order, begin);
+        uint64_t max_count = 0;
+        for (uint32_t d = 0; d < nr_of_dpus; d++) {
+            max_count = std::max(max_count, begin[d + 1] - begin[d]);
+        }
+
+        // Every round sends and receives only as many words as its
+        // fullest DPU needs.
+        for (uint64_t first = 0; first < max_count;
+             first += max_queries_per_dpu) {
+            uint32_t round_max =
+                std::min<uint64_t>(max_queries_per_dpu, max_count - first);
+            interface->ParallelFor(0, nr_of_dpus, [&](size_t d) {
+                uint64_t *batch = (uint64_t *)batch_buffers[d];
+                uint64_t count = begin[d + 1] - begin[d];
+                uint32_t nr_of_queries =
+                    first < count
+                        ? std::min<uint64_t>(round_max, count - first)
+                        : 0;
+                kv_batch_header_t header = {nr_of_queries, 0};
+                memcpy(batch, &header, sizeof(header));
+                const uint32_t *indices = order.data() + begin[d];
+                for (uint32_t j = 0; j < nr_of_queries; j++) {
+                    batch[1 + j] = keys[indices[first + j]];
+                }
+            });
+            uint32_t batch_size = (1 + round_max) * sizeof(uint64_t);
+            if (direct != nullptr &&
+                batch_size <= DirectPIMInterface::MAX_SMALL_TRANSFER_SIZE) {
+                direct->SendToPIMSmall(batch_buffers.data(), 0, batch_address,
+                                       batch_size);
+                interface->Launch(false);
+                direct->ReceiveFromPIMSmall(
+                    batch_buffers.data(), sizeof(uint64_t),
+                    batch_address + sizeof(kv_batch_header_t),
+                    round_max * sizeof(uint64_t));
+            } else {
+                allocator->Send(KV_BATCH_REGION, batch_buffers.data(), 0, 0,
+                                batch_size);
+                interface->Launch(false);
+                allocator->Receive(KV_BATCH_REGION, batch_buffers.data(),
+                                   sizeof(uint64_t), sizeof(kv_batch_header_t),
+                                   round_max * sizeof(uint64_t));
+            }
+            interface->ParallelFor(0, nr_of_dpus, [&](size_t d) {
+                const uint64_t *result = (const uint64_t *)batch_buffers[d] + 1;
+                const uint32_t *indices = order.data() + begin[d];
+                for (uint64_t j = first;
+                     j < begin[d + 1] - begin[d] && j < first + round_max;
+                     j++) {
+                    values[indices[j]] = result[j - first];
+                }
+            });
+            nr_of_rounds++;
+        }
+    }
+
+    // Launches taken by the last Lookup.
+    uint32_t GetNrOfRounds() const { return nr_of_rounds; }
+
+    uint32_t GetCapacityPerDPU() const { return capacity; }
+
+   private:
+    PIMInterface *interface;
+    // interface, if direct; batch_address is then KV_BATCH_REGION's MRAM
+    // address
+    DirectPIMInterface *direct;
+    uint32_t batch_address = 0;
+    PIMMRAMAllocator *allocator;
+    uint32_t nr_of_dpus, max_queries_per_dpu;
+    uint32_t capacity = 0, nr_of_rounds = 0;
+    bool table_allocated = false;
+    std::unique_ptr<uint64_t[]> batch_data;
+    std::vector<uint8_t *> batch_buffers;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+
+// Offset of byte `address_offset` of a DPU's MRAM inside the rank's mapped
+// region, for dpu_id 0..3 (the DPUs j * 8 + dpu_id share this cache line;
+// j * 8 + dpu_id + 4 use the next one, 0x40 further).
+inline uint64_t TranslateMRAMAddress(uint64_t address_offset,
+                                     uint32_t dpu_id) {
+    uint64_t mask_move_7 = (~((1 << 22) - 1)) + (1 << 13);  // 31..22, 13
+    uint64_t mask_move_6 = ((1 << 22) - (1 << 15));         // 21..15
+    uint64_t mask_move_14 = (1 << 14);                      // 14
+    uint64_t mask_move_4 = (1 << 13) - 1;                   // 12 .. 0
+    return ((address_offset & mask_move_7) << 7) |
+           ((address_offset & mask_move_6) << 6) |
+           ((address_offset & mask_move_14) << 14) |
+           ((address_offset & mask_move_4) << 4) | (dpu_id << 18);
+}
+
+// Reference layout, step by step. Slow; used to check the fast paths.
+inline uint64_t TranslateMRAMAddressOracle(uint64_t address_offset,
+                                           uint32_t dpu_id) {
+    uint64_t offset = 0;
+    // 1 : address_offset < 64MB
+    offset += (512ll << 20) * (address_offset >> 22);
+    address_offset &= (1ll << 22) - 1;
+    // 2 : address_offset < 4MB
+    if (address_offset & (16 << 10)) {
+        offset += (256ll << 20);
+    }
+    offset += (2ll << 20) * (address_offset / (32 << 10));
+    address_offset %= (16 << 10);
+    // 3 : address_offset < 16K
+    if (address_offset & (8 << 10)) {
+        offset += (1ll << 20);
+    }
+    address_offset %= (8 << 10);
+    offset += address_offset * 16;
+    // 4 : address_offset < 8K
+    offset += (dpu_id & 3) * (256 << 10);
+    // 5
+    if (dpu_id >= 4) {
+        offset += 64;
+    }
+    return offset;
+}
+
+// Walks TranslateMRAMAddress over consecutive 64-bit words. Inside an 8 KB
+// block the low 13 address bits are only shifted by 4, so the offset grows
+// by 128 bytes per word; the full translation runs once per block.
+class MRAMAddressIterator {
+public:
+    MRAMAddressIterator(uint64_t address_offset, uint32_t dpu_id)
+        : address_offset(address_offset),
+          dpu_id(dpu_id),
+          offset(TranslateMRAMAddress(address_offset, dpu_id)) {}
+
+    inline uint64_t operator*() const { return offset; }
+
+    inline MRAMAddressIterator& operator++() {
+        address_offset += sizeof(uint64_t);
+        if (address_offset & BLOCK_MASK) {
+            offset += sizeof(uint64_t) << 4;
+        } else {
+            offset = TranslateMRAMAddress(address_offset, dpu_id);
+        }
+        return *this;
+    }
+
+private:
+    static const uint64_t BLOCK_MASK = (8 << 10) - 1;
+
+    uint64_t address_offset;
+    uint32_t dpu_id;
+    uint64_t offset;
+};
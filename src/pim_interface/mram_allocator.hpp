@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <string>
+
+#include "mram_region_table.h"
+#include "pim_interface.hpp"
+
+// Named region of the MRAM heap, at the same offset on every DPU.
+struct PIMMRAMRegion {
+    std::string name;
+    uint32_t offset;  // from DPU_MRAM_HEAP_POINTER
+    uint32_t size;
+};
+
+// First-fit allocator over [0, heap_size) of the MRAM heap, uniform across
+// DPUs: the direct kernels write the same offset on all DPUs of a cache
+// line, so a shared layout is what every transfer can target. Publish
+// copies the region table to the DPUs' MRAM_REGIONS descriptor in WRAM,
+// where mram_regions.h looks regions up by name.
+class PIMMRAMAllocator {
+   public:
+    // Offsets are at least 8-byte aligned, as the transfer kernels move
+    // whole 64-bit words.
+    static const uint32_t MIN_ALIGNMENT = sizeof(uint64_t);
+
+    PIMMRAMAllocator(PIMInterface *interface, uint32_t heap_size)
+        : interface(interface),
+          heap_size(heap_size / MIN_ALIGNMENT * MIN_ALIGNMENT) {
+        free_ranges[0] = this->heap_size;
+    }
+
+    // nullptr if no free range fits.
+    const PIMMRAMRegion *Allocate(const std::string &name, uint32_t size,
+                                  uint32_t alignment = MIN_ALIGNMENT) {
+        assert(name.size() < MRAM_REGION_NAME_LENGTH);
+        assert(regions.count(name) == 0);
+        assert(regions.size() < MRAM_REGION_MAX_COUNT);
+        assert(alignment % MIN_ALIGNMENT == 0);
+        size = (size + MIN_ALIGNMENT - 1) / MIN_ALIGNMENT * MIN_ALIGNMENT;
+
+        for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+            uint64_t begin = it->first, end = begin + it->second;
+            uint64_t offset = (begin + alignment - 1) / alignment * alignment;
+            if (offset + size > end) {
+                continue;
+            }
+            free_ranges.erase(it);
+            if (offset > begin) {
+                free_ranges[begin] = offset - begin;
+            }
+            if (offset + size < end) {
+                free_ranges[offset + size] = end - offset - size;
+            }
+            PIMMRAMRegion &region = regions[name];
+            region = {name, (uint32_t)offset, size};
+            return &region;
+        }
+        return nullptr;
+    }
+
+    void Free(const std::string &name) {
+        auto region = regions.find(name);
+        assert(region != regions.end());
+        uint32_t begin = region->second.offset;
+        uint32_t end = begin + region->second.size;
+        regions.erase(region);
+
+        auto next = free_ranges.lower_bound(begin);
+        if (next != free_ranges.end() && next->first == end) {
+            end += next->second;
+            next = free_ranges.erase(next);
+        }
+        if (next != free_ranges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == begin) {
+                prev->second = end - prev->first;
+                return;
+            }
+        }
+        free_ranges[begin] = end - begin;
+    }
+
+    const PIMMRAMRegion &Get(const std::string &name) const {
+        auto region = regions.find(name);
+        assert(region != regions.end());
+        return region->second;
+    }
+
+    uint32_t GetFreeBytes() const {
+        uint32_t bytes = 0;
+        for (auto &range : free_ranges) {
+            bytes += range.second;
+        }
+        return bytes;
+    }
+
+    // Write the region table to every DPU; call again after changes that
+    // the DPU program needs to see.
+    void Publish() {
+        mram_region_table_t table;
+        memset(&table, 0, sizeof(table));
+        table.heap_size = heap_size;
+        for (auto &entry : regions) {
+            mram_region_t &out = table.regions[table.nr_of_regions++];
+            strncpy(out.name, entry.first.c_str(), MRAM_REGION_NAME_LENGTH - 1);
+            out.offset = entry.second.offset;
+            out.size = entry.second.size;
+        }
+        interface->BroadcastToPIMByUPMEM(&table, MRAM_REGION_TABLE_SYMBOL, 0,
+                                         sizeof(table), false);
+    }
+
+    // Transfers of [offset, offset + length) within a region.
+    void Send(const std::string &name, uint8_t **buffers,
+              uint32_t buffer_offset, uint32_t offset, uint32_t length) {
+        const PIMMRAMRegion &region = Get(name);
+        assert((uint64_t)offset + length <= region.size);
+        interface->SendToPIM(buffers, buffer_offset, DPU_MRAM_HEAP_POINTER_NAME,
+                             region.offset + offset, length, false);
+    }
+
+    void Receive(const std::string &name, uint8_t **buffers,
+                 uint32_t buffer_offset, uint32_t offset, uint32_t length) {
+        const PIMMRAMRegion &region = Get(name);
+        assert((uint64_t)offset + length <= region.size);
+        interface->ReceiveFromPIM(buffers, buffer_offset,
+                                  DPU_MRAM_HEAP_POINTER_NAME,
+                                  region.offset + offset, length, false);
+    }
+
+   private:
+    PIMInterface *interface;
+    uint32_t heap_size;
+    std::map<uint32_t, uint32_t> free_ranges;  // offset -> size
+    std::map<std::string, PIMMRAMRegion> regions;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "direct_interface.hpp"
+
+// Host copy of [symbol_offset, symbol_offset + length) of every DPU's MRAM
+// with dirty tracking per block_size bytes (a multiple of 8; 8 KB by
+// default, 64 for cache-line granularity). Updates go through Write or are
+// declared with MarkDirty; Sync sends only the dirty blocks and clears them.
+// Writes to disjoint blocks may come from different threads.
+class PIMShadowRegion {
+   public:
+    PIMShadowRegion(DirectPIMInterface* interface, std::string symbol_name,
+                    uint32_t symbol_offset, uint32_t length,
+                    uint32_t block_size = 8 << 10)
+        : interface(interface),
+          symbol_name(symbol_name),
+          symbol_offset(symbol_offset),
+          length(length),
+          block_size(block_size) {
+        assert(length % sizeof(uint64_t) == 0);
+        assert(block_size % sizeof(uint64_t) == 0 && block_size > 0);
+        nr_of_dpus = interface->GetNrOfDPUs();
+        nr_of_bitmap_words = ((length + block_size - 1) / block_size + 63) / 64;
+        data.reset(new uint8_t[(size_t)nr_of_dpus * length]());
+        dirty.assign((size_t)nr_of_dpus * nr_of_bitmap_words, 0);
+        buffers.resize(nr_of_dpus);
+        bitmaps.resize(nr_of_dpus);
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            buffers[i] = data.get() + (size_t)i * length;
+            bitmaps[i] = &dirty[(size_t)i * nr_of_bitmap_words];
+        }
+    }
+
+    // Read the region from every DPU; nothing is dirty afterwards.
+    void Load() {
+        interface->ReceiveFromPIM(buffers.data(), 0, symbol_name,
+                                  symbol_offset, length, false);
+        std::fill(dirty.begin(), dirty.end(), 0);
+    }
+
+    // Write the whole shadow to every DPU, e.g. after filling it initially.
+    void SyncAll() {
+        interface->SendToPIM(buffers.data(), 0, symbol_name, symbol_offset,
+                             length, false);
+        std::fill(dirty.begin(), dirty.end(), 0);
+    }
+
+    // Send the dirty blocks; returns the bytes written to MRAM.
+    uint64_t Sync() {
+        uint64_t bytes = interface->SendDirtyBlocksToPIM(
+            buffers.data(), symbol_name, symbol_offset, length, block_size,
+            bitmaps.data());
+        std::fill(dirty.begin(), dirty.end(), 0);
+        return bytes;
+    }
+
+    // Shadow bytes of a DPU. Changes made through this pointer must be
+    // declared with MarkDirty.
+    uint8_t* Data(uint32_t dpu_id) {
+        assert(dpu_id < nr_of_dpus);
+        return buffers[dpu_id];
+    }
+
+    void MarkDirty(uint32_t dpu_id, uint32_t offset, uint32_t size) {
+        assert(dpu_id < nr_of_dpus && (uint64_t)offset + size <= length);
+        if (size == 0) {
+            return;
+        }
+        uint64_t* bitmap = bitmaps[dpu_id];
+        for (uint32_t b = offset / block_size;
+             b <= (offset + size - 1) / block_size; b++) {
+            uint64_t bit = 1ull << (b % 64);
+            if (!(__atomic_load_n(&bitmap[b / 64], __ATOMIC_RELAXED) & bit)) {
+                __atomic_fetch_or(&bitmap[b / 64], bit, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    void Write(uint32_t dpu_id, uint32_t offset, const void* src,
+               uint32_t size) {
+        MarkDirty(dpu_id, offset, size);
+        memcpy(buffers[dpu_id] + offset, src, size);
+    }
+
+    template <typename T>
+    void Write(uint32_t dpu_id, uint32_t offset, const T& value) {
+        Write(dpu_id, offset, &value, sizeof(T));
+    }
+
+   private:
+    DirectPIMInterface* interface;
+    std::string symbol_name;
+    uint32_t symbol_offset, length, block_size;
+    uint32_t nr_of_dpus, nr_of_bitmap_words;
+    std::unique_ptr<uint8_t[]> data;
+    std::vector<uint64_t> dirty;
+    std::vector<uint8_t*> buffers;
+    std::vector<uint64_t*> bitmaps;
+};
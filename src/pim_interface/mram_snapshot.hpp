@@ -0,0 +1,390 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "direct_interface.hpp"
+
+// Snapshot of an MRAM heap range of every DPU, one file per rank in a
+// directory, written and read by one worker per rank:
+//
+//   PIMSnapshotHeader
+//   for each chunk, for each DPU of the rank, for each block of the chunk:
+//       PIMSnapshotBlock, followed by the block's bytes unless it is zero
+//
+// Blocks are 8 KB, the unit of the MRAM interleaving, and carry a checksum.
+const char PIM_SNAPSHOT_MAGIC[8] = {'P', 'I', 'M', 'S', 'N', 'A', 'P', '1'};
+
+struct PIMSnapshotHeader {
+    char magic[8];
+    uint64_t symbol_offset;
+    uint64_t length;
+    uint64_t chunk_size;
+    uint64_t first_dpu;
+    uint64_t nr_of_dpus;
+};
+
+struct PIMSnapshotBlock {
+    uint64_t checksum;
+    uint64_t is_zero;
+};
+
+class PIMSnapshot {
+public:
+    static constexpr uint64_t BLOCK_SIZE = 8 << 10;
+
+    // chunk_size bytes per DPU are staged in host memory at a time, twice
+    // that while restoring.
+    explicit PIMSnapshot(DirectPIMInterface* interface,
+                         uint64_t chunk_size = 128 << 10)
+        : interface(interface), chunk_size(chunk_size) {
+        assert(chunk_size % BLOCK_SIZE == 0);
+    }
+
+    // Save [symbol_offset, symbol_offset + length) of every DPU's heap.
+    // Returns false if the directory or a file cannot be created or written
+    // completely, e.g. on a full disk; the rank files are then removed.
+    bool Save(std::string directory, uint32_t symbol_offset, uint64_t length) {
+        assert(length % sizeof(uint64_t) == 0);
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Cannot create snapshot directory %s\n",
+                    directory.c_str());
+            return false;
+        }
+        std::vector<FILE*> files;
+        if (!OpenRankFiles(directory, "wb", files)) {
+            return false;
+        }
+        uint32_t nr_of_ranks = interface->GetNrOfRanks();
+        // Each rank's flag is only written by the worker of that rank.
+        std::vector<uint8_t> rank_ok(nr_of_ranks);
+        for (uint32_t r = 0; r < nr_of_ranks; r++) {
+            PIMSnapshotHeader header;
+            memcpy(header.magic, PIM_SNAPSHOT_MAGIC, sizeof(header.magic));
+            header.symbol_offset = symbol_offset;
+            header.length = length;
+            header.chunk_size = chunk_size;
+            header.first_dpu = GetFirstDPUOfRank(r);
+            header.nr_of_dpus = GetFirstDPUOfRank(r + 1) - header.first_dpu;
+            rank_ok[r] = fwrite(&header, sizeof(header), 1, files[r]) == 1;
+        }
+        auto AllOK = [&]() {
+            return std::find(rank_ok.begin(), rank_ok.end(), 0) ==
+                   rank_ok.end();
+        };
+
+        Staging staging(interface->GetNrOfDPUs(), chunk_size);
+        for (uint64_t begin = 0; begin < length && AllOK();
+             begin += chunk_size) {
+            uint64_t size = std::min(chunk_size, length - begin);
+            interface->ReceiveFromPIM(staging.buffers.data(), 0,
+                                      DPU_MRAM_HEAP_POINTER_NAME,
+                                      symbol_offset + begin, size, false);
+            interface->ParallelFor(0, nr_of_ranks, [&](size_t r) {
+                for (uint64_t i = GetFirstDPUOfRank(r);
+                     i < GetFirstDPUOfRank(r + 1) && rank_ok[r]; i++) {
+                    for (uint64_t b = 0; b < size && rank_ok[r];
+                         b += BLOCK_SIZE) {
+                        uint8_t* data = staging.buffers[i] + b;
+                        uint64_t block_size = std::min(BLOCK_SIZE, size - b);
+                        PIMSnapshotBlock block;
+                        block.is_zero = IsZero(data, block_size);
+                        block.checksum = Checksum(data, block_size);
+                        rank_ok[r] =
+                            fwrite(&block, sizeof(block), 1, files[r]) == 1 &&
+                            (block.is_zero ||
+                             fwrite(data, 1, block_size, files[r]) ==
+                                 block_size);
+                    }
+                }
+            });
+        }
+        bool ok = AllOK();
+        ok = CloseRankFiles(files) && ok;
+        if (!ok) {
+            fprintf(stderr, "Cannot write snapshot to %s\n", directory.c_str());
+            for (uint32_t r = 0; r < nr_of_ranks; r++) {
+                unlink(RankFilePath(directory, r).c_str());
+            }
+        }
+        return ok;
+    }
+
+    // Restore a snapshot taken on an interface with the same DPU layout.
+    // With skip_zero_blocks, blocks that were zero on every DPU of the
+    // interface are not written, i.e. the MRAM is assumed to be zero there.
+    //
+    // Every checksum is verified in a first pass over the files, so a
+    // missing, truncated or corrupted snapshot returns false with the MRAM
+    // untouched. The second pass reads the next chunk while the current one
+    // is sent.
+    bool Restore(std::string directory, bool skip_zero_blocks = false) {
+        std::vector<FILE*> files;
+        if (!OpenRankFiles(directory, "rb", files)) {
+            return false;
+        }
+        PIMSnapshotHeader header;
+        bool ok = ReadHeaders(files, header) && Verify(files, header);
+        for (size_t r = 0; ok && r < files.size(); r++) {
+            ok = fseek(files[r], sizeof(header), SEEK_SET) == 0;
+        }
+        if (ok) {
+            ok = Load(files, header, skip_zero_blocks);
+        }
+        CloseRankFiles(files);
+        return ok;
+    }
+
+private:
+    // chunk_size bytes for every DPU
+    struct Staging {
+        Staging(uint32_t nr_of_dpus, uint64_t chunk_size)
+            : data((uint8_t*)aligned_alloc(
+                  1 << 21, (nr_of_dpus * chunk_size + (1 << 21) - 1) >>
+                               21 << 21)),
+              buffers(nr_of_dpus) {
+            for (uint32_t i = 0; i < nr_of_dpus; i++) {
+                buffers[i] = data.get() + i * chunk_size;
+            }
+        }
+
+        struct Free {
+            void operator()(uint8_t* ptr) { free(ptr); }
+        };
+        std::unique_ptr<uint8_t, Free> data;
+        std::vector<uint8_t*> buffers;
+    };
+
+    // Read every rank's header; all must match this interface and agree on
+    // the saved range.
+    bool ReadHeaders(std::vector<FILE*>& files, PIMSnapshotHeader& header) {
+        for (uint32_t r = 0; r < files.size(); r++) {
+            PIMSnapshotHeader rank_header;
+            if (fread(&rank_header, sizeof(rank_header), 1, files[r]) != 1 ||
+                memcmp(rank_header.magic, PIM_SNAPSHOT_MAGIC, 8) != 0 ||
+                rank_header.chunk_size != chunk_size ||
+                rank_header.first_dpu != GetFirstDPUOfRank(r) ||
+                rank_header.nr_of_dpus !=
+                    GetFirstDPUOfRank(r + 1) - GetFirstDPUOfRank(r) ||
+                (r > 0 && (rank_header.symbol_offset != header.symbol_offset ||
+                           rank_header.length != header.length))) {
+                fprintf(stderr, "Snapshot header of rank %u does not match\n",
+                        r);
+                return false;
+            }
+            header = rank_header;
+        }
+        return true;
+    }
+
+    // Read the next block of `file` into data[0, block_size). False if the
+    // file ends early or the checksum does not match.
+    static bool ReadBlock(FILE* file, uint8_t* data, uint64_t block_size,
+                          bool& is_zero) {
+        PIMSnapshotBlock block;
+        if (fread(&block, sizeof(block), 1, file) != 1) {
+            return false;
+        }
+        is_zero = block.is_zero;
+        if (is_zero) {
+            memset(data, 0, block_size);
+        } else if (fread(data, 1, block_size, file) != block_size) {
+            return false;
+        }
+        return Checksum(data, block_size) == block.checksum;
+    }
+
+    static void ReportBadBlock(uint64_t dpu, uint64_t offset) {
+        fprintf(stderr,
+                "Snapshot block unreadable or corrupted: DPU %lu, offset %lu\n",
+                dpu, offset);
+    }
+
+    // Check every block of every rank file, one block of memory per rank.
+    bool Verify(std::vector<FILE*>& files, const PIMSnapshotHeader& header) {
+        std::atomic<bool> ok(true);
+        interface->ParallelFor(0, files.size(), [&](size_t r) {
+            std::vector<uint64_t> block(BLOCK_SIZE / sizeof(uint64_t));
+            for (uint64_t begin = 0; begin < header.length && ok;
+                 begin += chunk_size) {
+                uint64_t size = std::min(chunk_size, header.length - begin);
+                for (uint64_t i = GetFirstDPUOfRank(r);
+                     i < GetFirstDPUOfRank(r + 1); i++) {
+                    for (uint64_t b = 0; b < size; b += BLOCK_SIZE) {
+                        bool is_zero;
+                        if (!ReadBlock(files[r], (uint8_t*)block.data(),
+                                       std::min(BLOCK_SIZE, size - b),
+                                       is_zero)) {
+                            ReportBadBlock(i, begin + b);
+                            ok = false;
+                            return;
+                        }
+                    }
+                }
+            }
+        });
+        return ok.load();
+    }
+
+    // Stream the chunks into MRAM through two stagings, as AllToAll does:
+    // while chunk c is sent from one, chunk c + 1 is read into the other.
+    bool Load(std::vector<FILE*>& files, const PIMSnapshotHeader& header,
+              bool skip_zero_blocks) {
+        uint32_t nr_of_ranks = files.size();
+        uint64_t nr_of_blocks = chunk_size / BLOCK_SIZE;
+        uint64_t nr_of_chunks = (header.length + chunk_size - 1) / chunk_size;
+        Staging staging[2] = {Staging(interface->GetNrOfDPUs(), chunk_size),
+                              Staging(interface->GetNrOfDPUs(), chunk_size)};
+        std::vector<uint8_t> nonzero_block[2];
+
+        auto ReadChunk = [&](uint64_t c) {
+            Staging& st = staging[c % 2];
+            std::vector<uint8_t>& nonzero = nonzero_block[c % 2];
+            nonzero.assign(nr_of_ranks * nr_of_blocks, 0);
+            uint64_t begin = c * chunk_size;
+            uint64_t size = std::min(chunk_size, header.length - begin);
+            std::atomic<bool> ok(true);
+            interface->ParallelFor(0, nr_of_ranks, [&](size_t r) {
+                for (uint64_t i = GetFirstDPUOfRank(r);
+                     i < GetFirstDPUOfRank(r + 1); i++) {
+                    for (uint64_t b = 0; b < size; b += BLOCK_SIZE) {
+                        bool is_zero;
+                        if (!ReadBlock(files[r], st.buffers[i] + b,
+                                       std::min(BLOCK_SIZE, size - b),
+                                       is_zero)) {
+                            ReportBadBlock(i, begin + b);
+                            ok = false;
+                            return;
+                        }
+                        if (!is_zero) {
+                            nonzero[r * nr_of_blocks + b / BLOCK_SIZE] = 1;
+                        }
+                    }
+                }
+            });
+            return ok.load();
+        };
+
+        // Send runs of blocks, leaving out the all-zero ones if allowed.
+        auto SendChunk = [&](uint64_t c) {
+            Staging& st = staging[c % 2];
+            const std::vector<uint8_t>& nonzero = nonzero_block[c % 2];
+            uint64_t begin = c * chunk_size;
+            uint64_t size = std::min(chunk_size, header.length - begin);
+            for (uint64_t b = 0; b < nr_of_blocks && b * BLOCK_SIZE < size;) {
+                uint64_t e = b;
+                while (e < nr_of_blocks && e * BLOCK_SIZE < size &&
+                       (!skip_zero_blocks ||
+                        IsNonZeroOnAnyRank(nonzero, nr_of_ranks, nr_of_blocks,
+                                           e))) {
+                    e++;
+                }
+                if (e > b) {
+                    uint64_t run_end = std::min(e * BLOCK_SIZE, size);
+                    interface->SendToPIM(
+                        st.buffers.data(), b * BLOCK_SIZE,
+                        DPU_MRAM_HEAP_POINTER_NAME,
+                        header.symbol_offset + begin + b * BLOCK_SIZE,
+                        run_end - b * BLOCK_SIZE, false);
+                }
+                b = e + 1;
+            }
+        };
+
+        // Only a file changed since Verify can fail here.
+        if (nr_of_chunks == 0 || !ReadChunk(0)) {
+            return nr_of_chunks == 0;
+        }
+        for (uint64_t c = 0; c < nr_of_chunks; c++) {
+            bool next_ok = true;
+            interface->ParallelFor(0, 2, [&](size_t k) {
+                if (k == 0) {
+                    SendChunk(c);
+                } else if (c + 1 < nr_of_chunks) {
+                    next_ok = ReadChunk(c + 1);
+                }
+            });
+            if (!next_ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool IsNonZeroOnAnyRank(const std::vector<uint8_t>& nonzero_block,
+                                   uint32_t nr_of_ranks, uint64_t nr_of_blocks,
+                                   uint64_t b) {
+        for (uint32_t r = 0; r < nr_of_ranks; r++) {
+            if (nonzero_block[r * nr_of_blocks + b]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool IsZero(const uint8_t* data, uint64_t size) {
+        const uint64_t* words = (const uint64_t*)data;
+        uint64_t value = 0;
+        for (uint64_t i = 0; i < size / sizeof(uint64_t); i++) {
+            value |= words[i];
+        }
+        return value == 0;
+    }
+
+    static uint64_t Checksum(const uint8_t* data, uint64_t size) {
+        const uint64_t* words = (const uint64_t*)data;
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (uint64_t i = 0; i < size / sizeof(uint64_t); i++) {
+            hash = (hash ^ words[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    uint64_t GetFirstDPUOfRank(size_t rank_id) {
+        return interface->GetFirstDPUIDOfRank(rank_id);
+    }
+
+    // False, with nothing left open, if a file cannot be opened.
+    bool OpenRankFiles(std::string directory, const char* mode,
+                       std::vector<FILE*>& files) {
+        files.assign(interface->GetNrOfRanks(), nullptr);
+        for (size_t r = 0; r < files.size(); r++) {
+            std::string path = RankFilePath(directory, r);
+            files[r] = fopen(path.c_str(), mode);
+            if (files[r] == nullptr) {
+                fprintf(stderr, "Cannot open snapshot file %s\n", path.c_str());
+                files.resize(r);
+                CloseRankFiles(files);
+                return false;
+            }
+            setvbuf(files[r], nullptr, _IOFBF, 1 << 20);
+        }
+        return true;
+    }
+
+    static std::string RankFilePath(const std::string& directory,
+                                    size_t rank_id) {
+        return directory + "/rank_" + std::to_string(rank_id) + ".snap";
+    }
+
+    // False if a file could not be flushed.
+    static bool CloseRankFiles(std::vector<FILE*>& files) {
+        bool ok = true;
+        for (FILE* file : files) {
+            ok = fclose(file) == 0 && ok;
+        }
+        return ok;
+    }
+
+    DirectPIMInterface* interface;
+    uint64_t chunk_size;
+};
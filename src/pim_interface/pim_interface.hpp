@@ -2,17 +2,35 @@
 
 #include <cassert>
 #include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "pim_log.hpp"
+#include "pim_trace.hpp"
+#include "pim_worker_pool.hpp"
 
 extern "C" {
 #include <dpu.h>
 #include <dpu_rank.h>
 }
 
-const uint32_t MAX_NR_RANKS = 40;
 const uint32_t DPU_PER_RANK = 64;
 const uint64_t MRAM_SIZE = (64 << 20);
 
+// One item of a batched read: `length` bytes at `symbol_name + symbol_offset`
+// of every DPU, stored at `buffers[dpu] + buffer_offset`.
+struct PIMReadItem {
+    uint8_t** buffers;
+    uint32_t buffer_offset;
+    std::string symbol_name;
+    uint32_t symbol_offset;
+    uint32_t length;
+};
+
 class PIMInterface {
 public:
     virtual void load_from_dpu_set(dpu_set_t dpu_set) {
@@ -36,16 +54,138 @@ public:
 
     PIMInterface(dpu_set_t dpu_set): free_dpu_set_when_delete(true) { load_from_dpu_set(dpu_set); }
 
+    // Runs f(i) for i in [begin, end) in parallel, on parlay's workers or,
+    // once SetNrOfPrivateThreads was called, on this interface's own pool.
+    // parlay's scheduler expects a single external caller, so interfaces
+    // driven concurrently from several application threads use the latter.
+    template <typename F>
+    void ParallelFor(size_t begin, size_t end, F f) {
+        if (private_pool == nullptr) {
+            parlay::parallel_for(begin, end, f, 1, false);
+            return;
+        }
+        private_pool->ParallelFor(begin, end, f);
+    }
+
+    // Counting sort of [0, n) by DPU ID dpu_of(k): the indices of DPU d end
+    // up, in increasing order, at order[begin[d], begin[d + 1]). Per-block
+    // histograms, then every block places its indices at its own running
+    // offset per DPU.
+    template <typename F>
+    void SortByDPU(size_t n, F dpu_of, std::vector<uint32_t>& order,
+                   std::vector<uint64_t>& begin) {
+        assert(n <= UINT32_MAX);
+        const size_t BLOCK = 1 << 14;
+        size_t nr_of_blocks = std::max(
+            (size_t)1,
+            std::min((n + BLOCK - 1) / BLOCK, (size_t)parlay::num_workers() * 4));
+        size_t block_size = (n + nr_of_blocks - 1) / nr_of_blocks;
+        std::vector<uint64_t> position(nr_of_blocks * nr_of_dpus, 0);
+        ParallelFor(0, nr_of_blocks, [&](size_t b) {
+            uint64_t* count = &position[b * nr_of_dpus];
+            size_t end = std::min(n, (b + 1) * block_size);
+            for (size_t k = b * block_size; k < end; k++) {
+                uint32_t dpu = dpu_of(k);
+                assert(dpu < nr_of_dpus);
+                count[dpu]++;
+            }
+        });
+
+        std::vector<uint64_t> counts(nr_of_dpus, 0);
+        ParallelFor(0, nr_of_dpus, [&](size_t d) {
+            for (size_t b = 0; b < nr_of_blocks; b++) {
+                counts[d] += position[b * nr_of_dpus + d];
+            }
+        });
+        begin.assign(nr_of_dpus + 1, 0);
+        for (size_t d = 0; d < nr_of_dpus; d++) {
+            begin[d + 1] = begin[d] + counts[d];
+        }
+        ParallelFor(0, nr_of_dpus, [&](size_t d) {
+            uint64_t offset = begin[d];
+            for (size_t b = 0; b < nr_of_blocks; b++) {
+                uint64_t count = position[b * nr_of_dpus + d];
+                position[b * nr_of_dpus + d] = offset;
+                offset += count;
+            }
+        });
+
+        order.resize(n);
+        ParallelFor(0, nr_of_blocks, [&](size_t b) {
+            uint64_t* offset = &position[b * nr_of_dpus];
+            size_t end = std::min(n, (b + 1) * block_size);
+            for (size_t k = b * block_size; k < end; k++) {
+                order[offset[dpu_of(k)]++] = (uint32_t)k;
+            }
+        });
+    }
+
+    // Start a pool of nr_of_threads threads (the caller included) that
+    // serves every later ParallelFor until this interface is deleted.
+    void SetNrOfPrivateThreads(uint32_t nr_of_threads) {
+        assert(nr_of_threads > 0);
+        private_pool.reset(new PIMWorkerPool(nr_of_threads));
+    }
+
     virtual void Launch(bool async) = 0;
 
-    void sync() { DPU_ASSERT(dpu_sync(dpu_set)); }
+    void sync() {
+        PIM_TRACE_SCOPE("poll");
+        DPU_ASSERT(dpu_sync(dpu_set));
+    }
 
     template <typename F>
     void PrintLog(F filter) {
-        DPU_FOREACH(dpu_set, dpu, each_dpu) {
-            if (filter(each_dpu)) {
-                printf("*** %d ***\n", each_dpu);
-                DPU_ASSERT(dpu_log_read(dpu, stdout));
+        CollectLog(filter, PIMLogFileSink(stdout));
+    }
+
+    // Read the logs of the DPUs selected by filter, with one worker per rank
+    // decoding into memory, then hand them to sink(dpu_id, log) in DPU order.
+    template <typename F, typename Sink>
+    void CollectLog(F filter, Sink&& sink) {
+        std::vector<dpu_set_t> rank_sets;
+        std::vector<uint32_t> first_dpu_of_rank;
+        {
+            dpu_set_t rank;
+            uint32_t nr_dpus_before = 0;
+            DPU_RANK_FOREACH(dpu_set, rank) {
+                uint32_t nr_dpus_in_rank;
+                DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus_in_rank));
+                rank_sets.push_back(rank);
+                first_dpu_of_rank.push_back(nr_dpus_before);
+                nr_dpus_before += nr_dpus_in_rank;
+            }
+        }
+
+        std::vector<std::string> logs(nr_of_dpus);
+        std::vector<bool> selected(nr_of_dpus);
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            selected[i] = filter(i);
+        }
+        ParallelFor(
+            0, rank_sets.size(),
+            [&](size_t r) {
+                dpu_set_t dpu;
+                uint32_t each_dpu;
+                DPU_FOREACH(rank_sets[r], dpu, each_dpu) {
+                    uint32_t dpu_id = first_dpu_of_rank[r] + each_dpu;
+                    if (!selected[dpu_id]) {
+                        continue;
+                    }
+                    char* content = nullptr;
+                    size_t size = 0;
+                    FILE* stream = open_memstream(&content, &size);
+                    assert(stream != nullptr);
+                    DPU_ASSERT(dpu_log_read(dpu, stream));
+                    fclose(stream);
+                    logs[dpu_id].assign(content, size);
+                    free(content);
+                }
+            });
+
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            if (selected[i]) {
+                sink(i, logs[i]);
             }
         }
     }
@@ -57,10 +197,22 @@ public:
                                 uint32_t symbol_offset, uint32_t length,
                                 bool async) = 0;
 
+    // Read several small symbols from every DPU. Interfaces may merge items
+    // into fewer transfers.
+    virtual void ReceiveFromPIMBatch(const std::vector<PIMReadItem>& items) {
+        for (const PIMReadItem& item : items) {
+            ReceiveFromPIM(item.buffers, item.buffer_offset, item.symbol_name,
+                           item.symbol_offset, item.length, false);
+        }
+    }
+
     void SendToPIMByUPMEM(uint8_t** buffers, uint32_t buffer_offset, std::string symbol_name,
                           uint32_t symbol_offset, uint32_t length,
                           bool async_transfer) {
+        PIM_TRACE_SCOPE("upmem send");
         // Please make sure buffers don't overflow
+        dpu_set_t dpu;
+        uint32_t each_dpu;
         DPU_FOREACH(dpu_set, dpu, each_dpu) {
             DPU_ASSERT(dpu_prepare_xfer(dpu, buffers[each_dpu] + buffer_offset));
         }
@@ -69,10 +221,23 @@ public:
                                  symbol_offset, length, sync_setup));
     }
 
+    // The same `length` bytes to every DPU.
+    void BroadcastToPIMByUPMEM(const void* data, std::string symbol_name,
+                               uint32_t symbol_offset, uint32_t length,
+                               bool async_transfer) {
+        PIM_TRACE_SCOPE("upmem broadcast");
+        auto sync_setup = async_transfer ? DPU_XFER_ASYNC : DPU_XFER_DEFAULT;
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, symbol_name.c_str(), symbol_offset,
+                                    data, length, sync_setup));
+    }
+
     void ReceiveFromPIMByUPMEM(uint8_t** buffers, uint32_t buffer_offset, std::string symbol_name,
                                uint32_t symbol_offset, uint32_t length,
                                bool async_transfer) {
+        PIM_TRACE_SCOPE("upmem receive");
         // Please make sure buffers don't overflow
+        dpu_set_t dpu;
+        uint32_t each_dpu;
         DPU_FOREACH(dpu_set, dpu, each_dpu) {
             DPU_ASSERT(dpu_prepare_xfer(dpu, buffers[each_dpu] + buffer_offset));
         }
@@ -94,12 +259,42 @@ public:
 
     uint32_t GetNrOfDPUs() const { return nr_of_dpus; }
 
+    dpu_set_t GetDPUSet() const { return dpu_set; }
+
     void do_not_free_dpu_set_when_delete() { free_dpu_set_when_delete = false; }
 
 protected:
-    dpu_set_t dpu_set, dpu;
-    uint32_t each_dpu;
+    // dpu_launch for the Launch of both interfaces. While tracing, a
+    // synchronous launch is split into the boot and the poll until the DPUs
+    // stop, so that the two show up separately.
+    void LaunchDPUs(bool async) {
+        if (PIMTrace::Enabled() && !async) {
+            {
+                PIM_TRACE_SCOPE("launch");
+                DPU_ASSERT(dpu_launch(dpu_set, DPU_ASYNCHRONOUS));
+            }
+            sync();
+            return;
+        }
+        PIM_TRACE_SCOPE("launch");
+        auto async_parameter = async ? DPU_ASYNCHRONOUS : DPU_SYNCHRONOUS;
+        DPU_ASSERT(dpu_launch(dpu_set, async_parameter));
+    }
+
+    // Ranks [rank_begin, rank_end) of this interface as a dpu_set_t. It
+    // borrows the rank list, so it must not outlive this interface.
+    dpu_set_t GetRankSubset(uint32_t rank_begin, uint32_t rank_end) {
+        assert(dpu_set.kind == DPU_SET_RANKS);
+        assert(rank_begin < rank_end && rank_end <= nr_of_ranks);
+        dpu_set_t subset = dpu_set;
+        subset.list.nr_ranks = rank_end - rank_begin;
+        subset.list.ranks = dpu_set.list.ranks + rank_begin;
+        return subset;
+    }
+
+    dpu_set_t dpu_set;
     uint32_t nr_of_ranks, nr_of_dpus;
+    std::unique_ptr<PIMWorkerPool> private_pool;
 
     bool free_dpu_set_when_delete;
 };
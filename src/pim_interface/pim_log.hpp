@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <utility>
+
+// Sinks for PIMInterface::CollectLog. A sink is any callable taking
+// (uint32_t dpu_id, const std::string& log); it is called in DPU order from
+// the collecting thread.
+
+// Writes logs to a stream, in the same format as PrintLog.
+class PIMLogFileSink {
+public:
+    explicit PIMLogFileSink(FILE* stream) : stream(stream) {}
+
+    void operator()(uint32_t dpu_id, const std::string& log) {
+        fprintf(stream, "*** %u ***\n", dpu_id);
+        fwrite(log.data(), 1, log.size(), stream);
+    }
+
+private:
+    FILE* stream;
+};
+
+// Keeps the last `capacity` logs in memory, e.g. to dump them on error.
+// Like every sink it is only called from the collecting thread, so it is
+// not synchronized.
+class PIMLogRingSink {
+public:
+    explicit PIMLogRingSink(size_t capacity) : capacity(capacity) {}
+
+    void operator()(uint32_t dpu_id, const std::string& log) {
+        if (capacity == 0) {
+            return;
+        }
+        if (entries.size() == capacity) {
+            entries.pop_front();
+        }
+        entries.emplace_back(dpu_id, log);
+    }
+
+    std::deque<std::pair<uint32_t, std::string>> Drain() {
+        std::deque<std::pair<uint32_t, std::string>> result;
+        result.swap(entries);
+        return result;
+    }
+
+private:
+    size_t capacity;
+    std::deque<std::pair<uint32_t, std::string>> entries;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "dpu_profile_layout.h"
+#include "pim_interface.hpp"
+
+// DPU_PROFILE of every DPU, as collected by CollectPIMProfile.
+// A DPU's time for the whole program or a section is that of its slowest
+// tasklet.
+struct PIMProfileReport {
+    std::vector<dpu_profile_t> profiles;
+    std::vector<uint32_t> rank_of_dpu;
+    uint32_t nr_of_tasklets = 0;
+    std::vector<std::string> section_names;
+
+    // section -1 is the whole program.
+    uint64_t Cycles(uint32_t dpu_id, int section) const {
+        const uint64_t* cycles = section < 0
+                                     ? profiles[dpu_id].total
+                                     : profiles[dpu_id].sections[section];
+        return *std::max_element(cycles, cycles + nr_of_tasklets);
+    }
+
+    // Slowest over mean tasklet of a DPU; 1 is perfectly balanced.
+    double Imbalance(uint32_t dpu_id, int section) const {
+        const uint64_t* cycles = section < 0
+                                     ? profiles[dpu_id].total
+                                     : profiles[dpu_id].sections[section];
+        uint64_t sum = 0;
+        for (uint32_t t = 0; t < nr_of_tasklets; t++) {
+            sum += cycles[t];
+        }
+        return sum == 0 ? 1.0
+                        : (double)Cycles(dpu_id, section) * nr_of_tasklets / sum;
+    }
+
+    // Min, median, p99 and max over DPUs of the whole program and of every
+    // named section, the worst tasklet imbalance, and the slowest DPUs and
+    // ranks. Times assume the given DPU clock frequency.
+    void Print(FILE* out = stdout, double frequency = 350e6,
+               uint32_t nr_of_slowest = 5) const {
+        uint32_t nr_of_dpus = profiles.size();
+        if (nr_of_dpus == 0) {
+            return;
+        }
+        auto ms = [&](uint64_t cycles) { return cycles * 1e3 / frequency; };
+        for (int section = -1; section < (int)section_names.size(); section++) {
+            std::string name = section < 0 ? "total" : section_names[section];
+            if (name.empty()) {
+                continue;
+            }
+            std::vector<uint32_t> order(nr_of_dpus);
+            std::vector<uint64_t> rank_cycles;
+            double worst_imbalance = 1.0;
+            for (uint32_t i = 0; i < nr_of_dpus; i++) {
+                order[i] = i;
+                uint32_t rank = rank_of_dpu[i];
+                rank_cycles.resize(std::max((uint32_t)rank_cycles.size(), rank + 1), 0);
+                rank_cycles[rank] = std::max(rank_cycles[rank], Cycles(i, section));
+                worst_imbalance = std::max(worst_imbalance, Imbalance(i, section));
+            }
+            std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return Cycles(a, section) < Cycles(b, section);
+            });
+            auto at = [&](double q) {
+                return Cycles(order[std::min((uint32_t)(q * nr_of_dpus), nr_of_dpus - 1)],
+                              section);
+            };
+            fprintf(out,
+                    "%-16s min %8.3lf ms  median %8.3lf ms  p99 %8.3lf ms  "
+                    "max %8.3lf ms  worst tasklet imbalance %.2lf\n",
+                    name.c_str(), ms(at(0)), ms(at(0.5)), ms(at(0.99)),
+                    ms(at(1)), worst_imbalance);
+
+            fprintf(out, "%-16s slowest DPUs:", "");
+            for (uint32_t k = 0; k < std::min(nr_of_slowest, nr_of_dpus); k++) {
+                uint32_t dpu = order[nr_of_dpus - 1 - k];
+                fprintf(out, " %u (rank %u, %.3lf ms)", dpu, rank_of_dpu[dpu],
+                        ms(Cycles(dpu, section)));
+            }
+            fprintf(out, "\n");
+
+            std::vector<uint32_t> ranks(rank_cycles.size());
+            for (uint32_t r = 0; r < ranks.size(); r++) {
+                ranks[r] = r;
+            }
+            std::sort(ranks.begin(), ranks.end(), [&](uint32_t a, uint32_t b) {
+                return rank_cycles[a] > rank_cycles[b];
+            });
+            fprintf(out, "%-16s slowest ranks:", "");
+            for (uint32_t k = 0; k < std::min(nr_of_slowest, (uint32_t)ranks.size()); k++) {
+                fprintf(out, " %u (%.3lf ms)", ranks[k], ms(rank_cycles[ranks[k]]));
+            }
+            fprintf(out, "\n");
+        }
+    }
+};
+
+// DPU_PROFILE of every DPU (see dpu_lib/dpu_profile.h) in one batched read,
+// for a program run with nr_of_tasklets tasklets. section_names[i] names
+// section i; sections without a name are left out of reports.
+inline PIMProfileReport CollectPIMProfile(
+    PIMInterface* interface, uint32_t nr_of_tasklets,
+    std::vector<std::string> section_names) {
+    assert(nr_of_tasklets <= DPU_PROFILE_MAX_TASKLETS);
+    assert(section_names.size() <= DPU_PROFILE_MAX_SECTIONS);
+    uint32_t nr_of_dpus = interface->GetNrOfDPUs();
+    PIMProfileReport report;
+    report.nr_of_tasklets = nr_of_tasklets;
+    report.section_names = section_names;
+    report.profiles.resize(nr_of_dpus);
+    std::vector<uint8_t*> buffers(nr_of_dpus);
+    for (uint32_t i = 0; i < nr_of_dpus; i++) {
+        buffers[i] = (uint8_t*)&report.profiles[i];
+    }
+    interface->ReceiveFromPIMBatch(
+        {{buffers.data(), 0, DPU_PROFILE_SYMBOL, 0, sizeof(dpu_profile_t)}});
+
+    dpu_set_t dpu_set = interface->GetDPUSet();
+    dpu_set_t rank;
+    uint32_t rank_id = 0;
+    DPU_RANK_FOREACH(dpu_set, rank) {
+        uint32_t nr_dpus_in_rank;
+        DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus_in_rank));
+        report.rank_of_dpu.insert(report.rank_of_dpu.end(), nr_dpus_in_rank,
+                                  rank_id++);
+    }
+    return report;
+}
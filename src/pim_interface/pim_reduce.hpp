@@ -0,0 +1,25 @@
+#pragma once
+
+#include <limits>
+
+// Built-in associative operators for DirectPIMInterface::ReceiveFromPIMReduce.
+// A user functor works the same way: operator() combines two elements, and
+// Identity() (or an explicit identity argument) gives the neutral element.
+
+template <typename T>
+struct PIMReduceSum {
+    static T Identity() { return T(0); }
+    T operator()(T a, T b) const { return a + b; }
+};
+
+template <typename T>
+struct PIMReduceMin {
+    static T Identity() { return std::numeric_limits<T>::max(); }
+    T operator()(T a, T b) const { return b < a ? b : a; }
+};
+
+template <typename T>
+struct PIMReduceMax {
+    static T Identity() { return std::numeric_limits<T>::lowest(); }
+    T operator()(T a, T b) const { return a < b ? b : a; }
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Opt-in timeline of transfers and launches, exported as a Chrome trace
+// (chrome://tracing, Perfetto). Each thread records complete events into
+// its own ring buffer, so recording takes no lock; with tracing stopped a
+// scope costs one relaxed load. Building with PIM_TRACE_DISABLE removes the
+// scopes altogether.
+//
+// Events carry the rank they work on and are shown with one process per
+// rank; scopes without a rank inherit the enclosing scope's.
+class PIMTrace {
+   public:
+    struct Event {
+        const char* name;
+        int32_t rank;
+        uint64_t begin_ns, end_ns;
+    };
+
+    // Newest EVENTS_PER_THREAD events of a thread are kept.
+    static const uint32_t EVENTS_PER_THREAD = 1 << 15;
+
+    // Drops previous events and starts recording.
+    static void Start() {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (auto& buffer : buffers) {
+            buffer->next = 0;
+        }
+        origin = std::chrono::steady_clock::now();
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    static void Stop() { enabled.store(false, std::memory_order_relaxed); }
+
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    static uint64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - origin)
+            .count();
+    }
+
+    static void Record(const char* name, int32_t rank, uint64_t begin_ns,
+                       uint64_t end_ns) {
+        ThreadBuffer* buffer = GetThreadBuffer();
+        buffer->events[buffer->next % EVENTS_PER_THREAD] = {name, rank,
+                                                            begin_ns, end_ns};
+        buffer->next++;
+    }
+
+    // Call after Stop, once no transfer is running.
+    static bool WriteChromeTrace(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        fprintf(file, "{\"traceEvents\":[\n");
+        bool first = true;
+        std::vector<bool> named_process;
+        for (auto& buffer : buffers) {
+            uint64_t begin = buffer->next > EVENTS_PER_THREAD
+                                 ? buffer->next - EVENTS_PER_THREAD
+                                 : 0;
+            for (uint64_t k = begin; k < buffer->next; k++) {
+                const Event& event = buffer->events[k % EVENTS_PER_THREAD];
+                uint32_t pid = event.rank + 1;  // 0 is the host as a whole
+                if (pid >= named_process.size()) {
+                    named_process.resize(pid + 1, false);
+                }
+                if (!named_process[pid]) {
+                    named_process[pid] = true;
+                    std::string process =
+                        event.rank < 0 ? "host"
+                                       : "rank " + std::to_string(event.rank);
+                    fprintf(file,
+                            "%s{\"name\":\"process_name\",\"ph\":\"M\","
+                            "\"pid\":%u,\"args\":{\"name\":\"%s\"}}",
+                            first ? "" : ",\n", pid, process.c_str());
+                    first = false;
+                }
+                fprintf(file,
+                        "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,"
+                        "\"tid\":%u,\"ts\":%.3lf,\"dur\":%.3lf}",
+                        first ? "" : ",\n", event.name, pid, buffer->tid,
+                        event.begin_ns / 1e3,
+                        (event.end_ns - event.begin_ns) / 1e3);
+                first = false;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+
+   private:
+    // Owned by one thread at a time; a thread that exits hands its buffer,
+    // events included, to the next new thread.
+    struct ThreadBuffer {
+        uint32_t tid;
+        bool in_use;
+        uint64_t next = 0;
+        std::vector<Event> events;
+    };
+
+    struct ThreadBufferHolder {
+        ThreadBuffer* buffer = nullptr;
+        ~ThreadBufferHolder() {
+            if (buffer != nullptr) {
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                buffer->in_use = false;
+            }
+        }
+    };
+
+    static ThreadBuffer* GetThreadBuffer() {
+        thread_local ThreadBufferHolder holder;
+        if (holder.buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            for (auto& buffer : buffers) {
+                if (!buffer->in_use) {
+                    holder.buffer = buffer.get();
+                    break;
+                }
+            }
+            if (holder.buffer == nullptr) {
+                buffers.emplace_back(new ThreadBuffer());
+                holder.buffer = buffers.back().get();
+                holder.buffer->tid = buffers.size() - 1;
+                holder.buffer->events.resize(EVENTS_PER_THREAD);
+            }
+            holder.buffer->in_use = true;
+        }
+        return holder.buffer;
+    }
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::chrono::steady_clock::time_point origin;
+    static inline std::mutex registry_mutex;
+    static inline std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    friend class PIMTraceScope;
+    static inline thread_local int32_t current_rank = -1;
+};
+
+// Records [construction, destruction) as one event while tracing is on.
+class PIMTraceScope {
+   public:
+    explicit PIMTraceScope(const char* name, int32_t rank = -1) {
+        if (!PIMTrace::Enabled()) {
+            return;
+        }
+        this->name = name;
+        saved_rank = PIMTrace::current_rank;
+        this->rank = rank < 0 ? saved_rank : rank;
+        PIMTrace::current_rank = this->rank;
+        begin_ns = PIMTrace::Now();
+    }
+
+    ~PIMTraceScope() {
+        if (name == nullptr) {
+            return;
+        }
+        PIMTrace::Record(name, rank, begin_ns, PIMTrace::Now());
+        PIMTrace::current_rank = saved_rank;
+    }
+
+    PIMTraceScope(const PIMTraceScope&) = delete;
+    PIMTraceScope& operator=(const PIMTraceScope&) = delete;
+
+   private:
+    const char* name = nullptr;
+    int32_t rank, saved_rank;
+    uint64_t begin_ns;
+};
+
+#define PIM_TRACE_CONCAT_(a, b) a##b
+#define PIM_TRACE_CONCAT(a, b) PIM_TRACE_CONCAT_(a, b)
+#ifdef PIM_TRACE_DISABLE
+#define PIM_TRACE_SCOPE(...) \
+    do {                     \
+    } while (0)
+#else
+// PIM_TRACE_SCOPE(name[, rank]): trace the rest of the enclosing block.
+#define PIM_TRACE_SCOPE(...) \
+    PIMTraceScope PIM_TRACE_CONCAT(pim_trace_scope_, __LINE__)(__VA_ARGS__)
+#endif
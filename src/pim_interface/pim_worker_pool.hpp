@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads kept for the lifetime of an interface, for ParallelFor calls that
+// must not go through parlay's scheduler. A call publishes a job, works on
+// it itself and waits for the workers that joined it. Idle workers join the
+// newest open job, so a ParallelFor nested in another (AllToAll overlapping
+// its reads and sends) or issued from several threads at once is spread
+// over the pool as well. Async hands a whole task to an idle worker.
+class PIMWorkerPool {
+   public:
+    // nr_of_threads counts the calling thread: nr_of_threads - 1 workers.
+    explicit PIMWorkerPool(uint32_t nr_of_threads) {
+        for (uint32_t t = 1; t < nr_of_threads; t++) {
+            workers.emplace_back([this]() { Work(); });
+        }
+    }
+
+    ~PIMWorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_cv.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    PIMWorkerPool(const PIMWorkerPool&) = delete;
+    PIMWorkerPool& operator=(const PIMWorkerPool&) = delete;
+
+    uint32_t GetNrOfThreads() const { return workers.size() + 1; }
+
+    template <typename F>
+    void ParallelFor(size_t begin, size_t end, F& f) {
+        if (end - begin <= 1 || workers.empty()) {
+            for (size_t i = begin; i < end; i++) {
+                f(i);
+            }
+            return;
+        }
+        Job job;
+        job.run = [](void* context, size_t i) { (*(F*)context)(i); };
+        job.context = &f;
+        job.next = begin;
+        job.end = end;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            open_jobs.push_back(&job);
+        }
+        work_cv.notify_all();
+        RunItems(job);
+        std::unique_lock<std::mutex> lock(mutex);
+        Close(&job);
+        done_cv.wait(lock, [&]() { return job.nr_of_helpers == 0; });
+    }
+
+    // Run f() on a worker and return at once; the future is ready once f
+    // has returned. f may call ParallelFor on this pool, which the other
+    // idle workers then help with. Without workers f runs before Async
+    // returns.
+    template <typename F>
+    std::future<void> Async(F f) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(f));
+        std::future<void> done = task->get_future();
+        if (workers.empty()) {
+            (*task)();
+            return done;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back([task]() { (*task)(); });
+        }
+        work_cv.notify_one();
+        return done;
+    }
+
+   private:
+    struct Job {
+        void (*run)(void*, size_t);
+        void* context;
+        std::atomic<size_t> next;
+        size_t end;
+        uint32_t nr_of_helpers = 0;  // guarded by mutex
+    };
+
+    static void RunItems(Job& job) {
+        for (size_t i = job.next++; i < job.end; i = job.next++) {
+            job.run(job.context, i);
+        }
+    }
+
+    // With mutex held.
+    void Close(Job* job) {
+        for (size_t k = 0; k < open_jobs.size(); k++) {
+            if (open_jobs[k] == job) {
+                open_jobs.erase(open_jobs.begin() + k);
+                return;
+            }
+        }
+    }
+
+    // A job stays alive while it is open or has helpers, as its caller
+    // waits for both under mutex. Open jobs go before queued tasks, and
+    // queued tasks are finished before the pool stops.
+    void Work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_cv.wait(lock, [&]() {
+                return stopping || !open_jobs.empty() || !tasks.empty();
+            });
+            if (open_jobs.empty()) {
+                if (tasks.empty()) {
+                    return;
+                }
+                std::function<void()> task = std::move(tasks.front());
+                tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+                continue;
+            }
+            Job* job = open_jobs.back();
+            job->nr_of_helpers++;
+            lock.unlock();
+            RunItems(*job);
+            lock.lock();
+            Close(job);
+            if (--job->nr_of_helpers == 0) {
+                done_cv.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cv, done_cv;
+    std::vector<Job*> open_jobs;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+};
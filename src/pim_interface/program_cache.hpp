@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "direct_interface.hpp"
+
+// Keeps several DPU programs ready for fast switching. Each binary goes
+// through dpu_load once; its symbol table is kept alive and its IRAM/WRAM
+// image is captured. Switching then only broadcasts the image through the
+// control interfaces of the selected ranks.
+//
+// Not restored on switch: initialized __mram data and MRAM contents in
+// general. DPUs must be idle (after a synchronous launch or sync()).
+class PIMProgramCache {
+public:
+    explicit PIMProgramCache(DirectPIMInterface *interface)
+        : interface(interface) {}
+
+    ~PIMProgramCache() {
+        for (Kernel &kernel : kernels) {
+            dpu_free_program(kernel.program);
+        }
+    }
+
+    // Load `binary` on all ranks and capture it. Returns its kernel ID.
+    size_t Add(std::string binary) {
+        Kernel kernel;
+        kernel.binary = binary;
+        kernel.program = interface->LoadProgram(binary);
+        dpu_take_program_ref(kernel.program);
+        kernel.image = interface->ReadProgramImage();
+        kernels.push_back(std::move(kernel));
+        kernel_of_rank.assign(interface->GetNrOfRanks(), kernels.size() - 1);
+        return kernels.size() - 1;
+    }
+
+    void Switch(size_t kernel_id) {
+        Switch(kernel_id, 0, interface->GetNrOfRanks());
+    }
+
+    // Switch ranks [rank_begin, rank_end) to an added kernel. The whole
+    // WRAM is rewritten, so the new kernel starts as if freshly loaded.
+    void Switch(size_t kernel_id, size_t rank_begin, size_t rank_end) {
+        assert(kernel_id < kernels.size());
+        assert(rank_begin <= rank_end && rank_end <= kernel_of_rank.size());
+        const Kernel &kernel = kernels[kernel_id];
+        interface->ParallelFor(
+            rank_begin, rank_end,
+            [&](size_t i) {
+                if (kernel_of_rank[i] == kernel_id) {
+                    return;
+                }
+                interface->WriteRankProgramImage(i, kernel.image);
+                kernel_of_rank[i] = kernel_id;
+            });
+        interface->SetProgramOfRanks(kernel.program, rank_begin, rank_end);
+    }
+
+    size_t GetKernelOfRank(size_t rank_id) const {
+        return kernel_of_rank[rank_id];
+    }
+
+    const std::string &GetBinary(size_t kernel_id) const {
+        return kernels[kernel_id].binary;
+    }
+
+private:
+    struct Kernel {
+        std::string binary;
+        dpu_program_t *program;
+        PIMProgramImage image;
+    };
+
+    DirectPIMInterface *interface;
+    std::vector<Kernel> kernels;
+    std::vector<size_t> kernel_of_rank;
+};
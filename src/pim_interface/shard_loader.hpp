@@ -0,0 +1,201 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "direct_interface.hpp"
+
+// Sharded dataset file: shard i is loaded into DPU i.
+//
+//   PIMShardFileHeader
+//   PIMShardIndexEntry[nr_of_shards]
+//   shard data, each shard at a multiple of 8 bytes with a multiple of 8 bytes
+const char PIM_SHARD_FILE_MAGIC[8] = {'P', 'I', 'M', 'S', 'H', 'R', 'D', '1'};
+
+struct PIMShardFileHeader {
+    char magic[8];
+    uint64_t nr_of_shards;
+};
+
+struct PIMShardIndexEntry {
+    uint64_t offset;  // from the start of the file
+    uint64_t length;  // bytes
+};
+
+// Write buffers[i][0, lengths[i]) as shard i; shards are padded to 8 bytes.
+// Returns false, removing the file, if it cannot be written completely.
+inline bool WritePIMShardFile(std::string path, uint8_t** buffers,
+                              const uint64_t* lengths, uint64_t nr_of_shards) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot create shard file %s\n", path.c_str());
+        return false;
+    }
+    PIMShardFileHeader header;
+    memcpy(header.magic, PIM_SHARD_FILE_MAGIC, sizeof(header.magic));
+    header.nr_of_shards = nr_of_shards;
+    std::vector<PIMShardIndexEntry> index(nr_of_shards);
+    uint64_t offset =
+        sizeof(header) + nr_of_shards * sizeof(PIMShardIndexEntry);
+    for (uint64_t i = 0; i < nr_of_shards; i++) {
+        uint64_t padded = (lengths[i] + 7) / 8 * 8;
+        index[i] = {offset, padded};
+        offset += padded;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(index.data(), sizeof(PIMShardIndexEntry), nr_of_shards,
+                     file) == nr_of_shards;
+    const uint8_t zeros[8] = {0};
+    for (uint64_t i = 0; i < nr_of_shards && ok; i++) {
+        uint64_t padding = index[i].length - lengths[i];
+        ok = fwrite(buffers[i], 1, lengths[i], file) == lengths[i] &&
+             fwrite(zeros, 1, padding, file) == padding;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Cannot write shard file %s\n", path.c_str());
+        unlink(path.c_str());
+    }
+    return ok;
+}
+
+struct PIMShardLoadResult {
+    std::vector<uint64_t> lengths;  // shard bytes, a multiple of 8
+    // MRAM bytes written at symbol_offset: lengths[i] followed by zeros up
+    // to the longest shard of the DPUs sharing its cache lines (see
+    // SendRaggedToPIM).
+    std::vector<uint64_t> written;
+};
+
+// Loads a shard file into the MRAM heap of every DPU without staging it in
+// per-DPU host buffers: the file is memory-mapped and each DPU's range of
+// the mapping is handed to SendRaggedToPIM directly, chunk_size bytes per
+// DPU at a time. Before a chunk is sent, kernel readahead is started for the
+// next one, so disk reads overlap the transfer; sent pages are released so
+// resident memory stays bounded.
+class PIMShardLoader {
+public:
+    explicit PIMShardLoader(DirectPIMInterface* interface,
+                            uint64_t chunk_size = 1 << 20)
+        : interface(interface), chunk_size(chunk_size) {
+        assert(chunk_size % sysconf(_SC_PAGESIZE) == 0);
+    }
+
+    // Shard i lands at `symbol_offset` of the heap of DPU i. MRAM past
+    // written[i] is untouched; between lengths[i] and written[i] it is
+    // zeroed. Returns false, with the MRAM untouched, if the file cannot be
+    // read, is not a shard file for this many DPUs, has an index pointing
+    // outside of it or shards that do not fit in the heap.
+    bool Load(std::string path, uint32_t symbol_offset,
+              PIMShardLoadResult& result) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open shard file %s\n", path.c_str());
+            return false;
+        }
+        struct stat st;
+        uint8_t* map = (uint8_t*)MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            map = (uint8_t*)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+                                 fd, 0);
+        }
+        close(fd);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Cannot map shard file %s\n", path.c_str());
+            return false;
+        }
+        size_t file_size = st.st_size;
+
+        uint32_t nr_of_dpus = interface->GetNrOfDPUs();
+        std::vector<uint64_t> lengths(nr_of_dpus);
+        uint64_t max_length = 0;
+        if (!CheckIndex(map, file_size, lengths, max_length) ||
+            (uint64_t)symbol_offset + max_length >
+                interface->GetMRAMHeapSize()) {
+            fprintf(stderr, "Invalid shard file %s\n", path.c_str());
+            munmap(map, file_size);
+            return false;
+        }
+        const PIMShardIndexEntry* index =
+            (const PIMShardIndexEntry*)(map + sizeof(PIMShardFileHeader));
+
+        std::vector<uint8_t*> buffers(nr_of_dpus);
+        std::vector<uint64_t> chunk_lengths(nr_of_dpus);
+        auto ChunkRange = [&](uint32_t i, uint64_t begin, uint64_t& length) {
+            begin = std::min(begin, lengths[i]);
+            length = std::min(chunk_size, lengths[i] - begin);
+            return map + index[i].offset + begin;
+        };
+        auto Advise = [&](uint64_t begin, int advice) {
+            for (uint32_t i = 0; i < nr_of_dpus; i++) {
+                uint64_t length;
+                uint8_t* ptr = ChunkRange(i, begin, length);
+                if (length == 0) {
+                    continue;
+                }
+                uintptr_t page = (uintptr_t)ptr & ~page_mask;
+                madvise((void*)page, (uintptr_t)ptr + length - page, advice);
+            }
+        };
+
+        Advise(0, MADV_WILLNEED);
+        for (uint64_t begin = 0; begin < max_length; begin += chunk_size) {
+            Advise(begin + chunk_size, MADV_WILLNEED);
+            for (uint32_t i = 0; i < nr_of_dpus; i++) {
+                buffers[i] = ChunkRange(i, begin, chunk_lengths[i]);
+            }
+            interface->SendRaggedToPIM(buffers.data(), chunk_lengths.data(),
+                                       DPU_MRAM_HEAP_POINTER_NAME,
+                                       symbol_offset + begin);
+            Advise(begin, MADV_DONTNEED);
+        }
+
+        munmap(map, file_size);
+        result.written = interface->GetRaggedWriteExtents(lengths.data());
+        result.lengths = std::move(lengths);
+        return true;
+    }
+
+private:
+    // Header and index of a mapped file: one shard per DPU, each 8-byte
+    // aligned and within the file.
+    bool CheckIndex(const uint8_t* map, size_t file_size,
+                    std::vector<uint64_t>& lengths, uint64_t& max_length) {
+        uint64_t nr_of_dpus = lengths.size();
+        if (file_size < sizeof(PIMShardFileHeader)) {
+            return false;
+        }
+        const PIMShardFileHeader* header = (const PIMShardFileHeader*)map;
+        if (memcmp(header->magic, PIM_SHARD_FILE_MAGIC, 8) != 0 ||
+            header->nr_of_shards != nr_of_dpus ||
+            file_size - sizeof(PIMShardFileHeader) <
+                nr_of_dpus * sizeof(PIMShardIndexEntry)) {
+            return false;
+        }
+        const PIMShardIndexEntry* index =
+            (const PIMShardIndexEntry*)(map + sizeof(PIMShardFileHeader));
+        for (uint64_t i = 0; i < nr_of_dpus; i++) {
+            if (index[i].offset % 8 != 0 || index[i].length % 8 != 0 ||
+                index[i].offset > file_size ||
+                index[i].length > file_size - index[i].offset) {
+                return false;
+            }
+            lengths[i] = index[i].length;
+            max_length = std::max(max_length, lengths[i]);
+        }
+        return true;
+    }
+
+    const uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+
+    DirectPIMInterface* interface;
+    uint64_t chunk_size;
+};
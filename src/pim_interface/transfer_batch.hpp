@@ -0,0 +1,62 @@
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "direct_interface.hpp"
+
+// A recorded sequence of MRAM sends and receives, executed in one fused
+// pass per rank by DirectPIMInterface::ExecuteBatch. A batch can be
+// executed again every round; buffers are read at execution time.
+class PIMTransferBatch {
+   public:
+    explicit PIMTransferBatch(DirectPIMInterface *interface)
+        : interface(interface) {}
+
+    ~PIMTransferBatch() { Wait(); }
+
+    PIMTransferBatch &Send(uint8_t **buffers, uint32_t buffer_offset,
+                           std::string symbol_name, uint32_t symbol_offset,
+                           uint32_t length) {
+        commands.push_back({true, buffers, buffer_offset, symbol_name,
+                            symbol_offset, length});
+        return *this;
+    }
+
+    PIMTransferBatch &Receive(uint8_t **buffers, uint32_t buffer_offset,
+                              std::string symbol_name, uint32_t symbol_offset,
+                              uint32_t length) {
+        commands.push_back({false, buffers, buffer_offset, symbol_name,
+                            symbol_offset, length});
+        return *this;
+    }
+
+    void Execute() {
+        Wait();
+        interface->ExecuteBatch(commands);
+    }
+
+    // Returns at once; Wait must be called before the buffers are used or
+    // the interface is used for anything else.
+    void ExecuteAsync() {
+        Wait();
+        pending = interface->ExecuteBatchAsync(commands);
+    }
+
+    void Wait() {
+        if (pending.valid()) {
+            pending.get();
+        }
+    }
+
+    void Clear() {
+        Wait();
+        commands.clear();
+    }
+
+   private:
+    DirectPIMInterface *interface;
+    std::vector<PIMTransferCommand> commands;
+    std::future<void> pending;
+};
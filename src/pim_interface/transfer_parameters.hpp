@@ -0,0 +1,83 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Knobs of the direct MRAM transfer kernels. A machine profile is a text
+// file of "name value" lines; missing names keep their defaults.
+struct PIMTransferParameters {
+    // How many words ahead receive kernels prefetch rank memory.
+    uint32_t mram_prefetch_words = 3;
+    // How many words ahead kernels prefetch host buffers; a multiple of 8.
+    uint32_t buffer_prefetch_words = 8;
+    // Tasks per rank for MRAM transfers, 0 to derive it from the workers.
+    uint32_t nr_of_tasks_per_rank = 0;
+    // Send with streaming stores, or with regular stores and clflushopt;
+    // small transfers included.
+    uint32_t streaming_send = 1;
+
+    bool Load(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "r");
+        if (file == nullptr) {
+            return false;
+        }
+        char name[64];
+        unsigned value;
+        while (fscanf(file, "%63s %u", name, &value) == 2) {
+            if (strcmp(name, "mram_prefetch_words") == 0) {
+                mram_prefetch_words = value;
+            } else if (strcmp(name, "buffer_prefetch_words") == 0) {
+                buffer_prefetch_words = (value + 7) / 8 * 8;
+            } else if (strcmp(name, "nr_of_tasks_per_rank") == 0) {
+                nr_of_tasks_per_rank = value;
+            } else if (strcmp(name, "streaming_send") == 0) {
+                streaming_send = value != 0;
+            }
+        }
+        fclose(file);
+        return true;
+    }
+
+    bool Save(const std::string &path) const {
+        FILE *file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        fprintf(file, "mram_prefetch_words %u\n", mram_prefetch_words);
+        fprintf(file, "buffer_prefetch_words %u\n", buffer_prefetch_words);
+        fprintf(file, "nr_of_tasks_per_rank %u\n", nr_of_tasks_per_rank);
+        fprintf(file, "streaming_send %u\n", streaming_send);
+        return fclose(file) == 0;
+    }
+
+    // Profile next to the running binary.
+    static std::string LocalProfilePath() {
+        char exe[PATH_MAX];
+        ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (len <= 0) {
+            return PROFILE_NAME;
+        }
+        std::string path(exe, len);
+        return path.substr(0, path.rfind('/') + 1) + PROFILE_NAME;
+    }
+
+    // First of $PIM_TRANSFER_PROFILE, the local profile and
+    // /etc/pim_transfer.profile that can be read. Returns false, keeping the
+    // defaults, if none can.
+    bool LoadDefault() {
+        const char *env = getenv("PIM_TRANSFER_PROFILE");
+        if (env != nullptr) {
+            return Load(env);
+        }
+        return Load(LocalProfilePath()) ||
+               Load(std::string("/etc/") + PROFILE_NAME);
+    }
+
+    static constexpr const char *PROFILE_NAME = "pim_transfer.profile";
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "direct_interface.hpp"
+#include "transfer_parameters.hpp"
+
+// Calibrates the direct transfer kernels on this machine: each knob is swept
+// in turn, keeping the best value found so far for the others, and scored by
+// the combined send and receive bandwidth of `length` bytes per DPU of the
+// MRAM heap. The heap contents are overwritten. Every DPU has a buffer of
+// its own, as in real transfers; `length` shrinks so that all of them fit in
+// max_host_bytes.
+class PIMTransferTuner {
+   public:
+    PIMTransferTuner(DirectPIMInterface *interface, uint32_t length = 4 << 20,
+                     int repeat = 3, uint64_t max_host_bytes = 2ull << 30)
+        : interface(interface), repeat(repeat) {
+        this->length = std::min<uint64_t>(
+            length, max_host_bytes / interface->GetNrOfDPUs() /
+                        sizeof(uint64_t) * sizeof(uint64_t));
+        assert(this->length > 0 && this->length % sizeof(uint64_t) == 0 &&
+               this->length <= interface->GetMRAMHeapSize());
+    }
+
+    PIMTransferParameters Calibrate() {
+        uint32_t nr_of_dpus = interface->GetNrOfDPUs();
+        std::vector<uint8_t> data((size_t)nr_of_dpus * length);
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = (uint8_t)(i * 0x9e3779b1u >> 24);
+        }
+        buffers.resize(nr_of_dpus);
+        for (uint32_t i = 0; i < nr_of_dpus; i++) {
+            buffers[i] = data.data() + (size_t)i * length;
+        }
+
+        PIMTransferParameters best = interface->GetTransferParameters();
+        double best_bandwidth = Measure(best);
+        auto Sweep = [&](uint32_t PIMTransferParameters::*knob,
+                         const std::vector<uint32_t> &values) {
+            for (uint32_t value : values) {
+                PIMTransferParameters candidate = best;
+                candidate.*knob = value;
+                double bandwidth = Measure(candidate);
+                if (bandwidth > best_bandwidth) {
+                    best = candidate;
+                    best_bandwidth = bandwidth;
+                }
+            }
+        };
+        Sweep(&PIMTransferParameters::nr_of_tasks_per_rank,
+              {4, 8, 12, 16, 24, 32});
+        Sweep(&PIMTransferParameters::mram_prefetch_words, {1, 2, 3, 4, 6, 8});
+        Sweep(&PIMTransferParameters::buffer_prefetch_words, {8, 16, 24, 32});
+        Sweep(&PIMTransferParameters::streaming_send, {0, 1});
+
+        interface->SetTransferParameters(best);
+        printf("Calibrated: %.3lf GB/s with %u tasks per rank, prefetch %u/%u, "
+               "streaming send %u\n",
+               best_bandwidth / (1 << 30), best.nr_of_tasks_per_rank,
+               best.mram_prefetch_words, best.buffer_prefetch_words,
+               best.streaming_send);
+        buffers.clear();
+        return best;
+    }
+
+   private:
+    // Bytes per second of one send plus one receive, best of `repeat`.
+    double Measure(const PIMTransferParameters &parameters) {
+        interface->SetTransferParameters(parameters);
+        double best = 0;
+        for (int r = 0; r < repeat; r++) {
+            auto start = std::chrono::steady_clock::now();
+            interface->SendToPIM(buffers.data(), 0, DPU_MRAM_HEAP_POINTER_NAME,
+                                 0, length, false);
+            interface->ReceiveFromPIM(buffers.data(), 0,
+                                      DPU_MRAM_HEAP_POINTER_NAME, 0, length,
+                                      false);
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            best = std::max(best, 2.0 * buffers.size() * length /
+                                      elapsed.count());
+        }
+        return best;
+    }
+
+    DirectPIMInterface *interface;
+    uint32_t length;
+    int repeat;
+    std::vector<uint8_t *> buffers;
+};
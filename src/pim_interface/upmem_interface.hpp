@@ -13,8 +13,7 @@ public:
     }
 
     void Launch(bool async) {
-        auto async_parameter = async ? DPU_ASYNCHRONOUS : DPU_SYNCHRONOUS;
-        DPU_ASSERT(dpu_launch(dpu_set, async_parameter));
+        LaunchDPUs(async);
     }
 
     UPMEMInterface(int nr_ranks, std::string dpu_program) : PIMInterface(nr_ranks, dpu_program) {
@@ -24,4 +23,12 @@ public:
     UPMEMInterface(dpu_set_t dpu_set) : PIMInterface(dpu_set) {
 
     };
+
+    // An independent interface over ranks [rank_begin, rank_end). This
+    // interface must outlive it.
+    UPMEMInterface* CreateRankGroup(uint32_t rank_begin, uint32_t rank_end) {
+        UPMEMInterface* group = new UPMEMInterface(GetRankSubset(rank_begin, rank_end));
+        group->do_not_free_dpu_set_when_delete();
+        return group;
+    }
 };